@@ -53,7 +53,16 @@ SOURCES += src/main.cpp\
     src/metatile_obstacles.cpp \
     src/coursewindow.cpp \
     src/previewscene.cpp \
-    src/mapchange.cpp
+    src/mapchange.cpp \
+    src/playfield.cpp \
+    src/budgetwidget.cpp \
+    src/tileatlas.cpp \
+    src/previewrenderer.cpp \
+    src/graphicscache.cpp \
+    src/palette.cpp \
+    src/previewanimation.cpp \
+    src/coursebrowser.cpp \
+    src/previewcache.cpp
 
 HEADERS  += src/mainwindow.h \
     src/tileeditwindow.h \
@@ -69,7 +78,17 @@ HEADERS  += src/mainwindow.h \
     src/coursewindow.h \
     src/version.h \
     src/previewscene.h \
-    src/mapchange.h
+    src/mapchange.h \
+    src/playfield.h \
+    src/budgetwidget.h \
+    src/tileatlas.h \
+    src/previewrenderer.h \
+    src/graphicscache.h \
+    src/palette.h \
+    src/previewanimation.h \
+    src/obstaclesprites.h \
+    src/coursebrowser.h \
+    src/previewcache.h
 
 FORMS    += src/mainwindow.ui \
     src/tileeditwindow.ui \
@@ -0,0 +1,192 @@
+/*
+  budgetwidget.cpp
+
+  Contains the panel which shows how much ROM space the level being edited will use, i.e. how
+  big the 3D tilemap is compared to the space available for it, and how big each chunk is
+  before and after compression. This is updated in the background (using the same code that
+  saves levels to the ROM) shortly after the level is edited.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QThreadPool>
+#include <QtWidgets/QGridLayout>
+
+#include "budgetwidget.h"
+#include "compress.h"
+#include "level.h"
+
+// how long to wait after an edit before updating (in msec)
+#define BUDGET_DELAY 250
+
+static const char *chunkNames[NUM_LEVEL_CHUNKS] = {
+    "Header",
+    "Terrain",
+    "Obstacles",
+    "Heights",
+    "Flags",
+    "Row starts",
+    "Row ends",
+    "Row offsets",
+    "Tilemap layer 1",
+    "Tilemap layer 2",
+    "Clipping table"
+};
+
+BudgetWorker::BudgetWorker(const leveldata_t *level, const budget_t &last)
+    : QObject(),
+      level(*level),
+      budget(last)
+{
+    this->setAutoDelete(false);
+}
+
+void BudgetWorker::run() {
+    // buffer for compressed data (see saveLevel)
+    uint8_t packed[2 * BIG_CHUNK_SIZE];
+
+    QList<QByteArray> chunks = makeLevelChunks(&level, &budget.fieldSize);
+
+    for (int i = 0; i < NUM_LEVEL_CHUNKS && i < chunks.size(); i++) {
+        // only compress chunks which have changed since last time
+        if (budget.packedSize[i] >= 0 && chunks[i] == budget.unpacked[i])
+            continue;
+
+        budget.unpacked[i] = chunks[i];
+
+        // the header is never compressed
+        if (i == 0)
+            budget.packedSize[i] = chunks[i].size();
+        else
+            budget.packedSize[i] = pack((uint8_t*)chunks[i].constData(), chunks[i].size(),
+                                        packed, 1);
+    }
+
+    emit finished();
+}
+
+BudgetWidget::BudgetWidget(QWidget *parent, leveldata_t *currentLevel)
+    : QWidget(parent),
+      level(currentLevel),
+      worker(NULL),
+      pending(false),
+      fieldBar(new QProgressBar(this)),
+      totalLabel(new QLabel(this))
+{
+    pool.setMaxThreadCount(1);
+
+    QGridLayout *layout = new QGridLayout(this);
+
+    layout->addWidget(new QLabel(tr("3D tilemap:"), this), 0, 0);
+    layout->addWidget(fieldBar, 0, 1, 1, 2);
+    fieldBar->setRange(0, BIG_CHUNK_SIZE);
+
+    layout->addWidget(new QLabel(tr("<b>Chunk</b>"), this), 1, 0);
+    layout->addWidget(new QLabel(tr("<b>Size</b>"), this), 1, 1, Qt::AlignRight);
+    layout->addWidget(new QLabel(tr("<b>Compressed</b>"), this), 1, 2, Qt::AlignRight);
+
+    for (int i = 0; i < NUM_LEVEL_CHUNKS; i++) {
+        unpackedLabels[i] = new QLabel(this);
+        packedLabels[i]   = new QLabel(this);
+
+        layout->addWidget(new QLabel(chunkNames[i], this), i + 2, 0);
+        layout->addWidget(unpackedLabels[i], i + 2, 1, Qt::AlignRight);
+        layout->addWidget(packedLabels[i],   i + 2, 2, Qt::AlignRight);
+    }
+
+    layout->addWidget(new QLabel(tr("<b>Total</b>"), this), NUM_LEVEL_CHUNKS + 2, 0);
+    layout->addWidget(totalLabel, NUM_LEVEL_CHUNKS + 2, 2, Qt::AlignRight);
+    layout->setRowStretch(NUM_LEVEL_CHUNKS + 3, 1);
+
+    timer.setSingleShot(true);
+    timer.setInterval(BUDGET_DELAY);
+    QObject::connect(&timer, SIGNAL(timeout()),
+                     this, SLOT(startWorker()));
+
+    clearBudget();
+    showBudget();
+}
+
+BudgetWidget::~BudgetWidget() {
+    // don't leave a worker running with nowhere to go
+    if (worker) {
+        pool.waitForDone();
+        delete worker;
+    }
+}
+
+void BudgetWidget::clearBudget() {
+    budget.fieldSize = 0;
+    for (int i = 0; i < NUM_LEVEL_CHUNKS; i++) {
+        budget.unpacked[i].clear();
+        budget.packedSize[i] = -1;
+    }
+}
+
+void BudgetWidget::refresh() {
+    // (re)start the timer, so the worker only runs once the level stops changing
+    timer.start();
+}
+
+void BudgetWidget::startWorker() {
+    // only run one worker at a time; if one is already running, then
+    // start another one once it's done
+    if (worker) {
+        pending = true;
+        return;
+    }
+    pending = false;
+
+    if (level->header.length == 0 || level->header.width == 0) {
+        clearBudget();
+        showBudget();
+        return;
+    }
+
+    worker = new BudgetWorker(level, budget);
+    QObject::connect(worker, SIGNAL(finished()),
+                     this, SLOT(workerFinished()));
+    pool.start(worker);
+}
+
+void BudgetWidget::workerFinished() {
+    budget = worker->getBudget();
+    worker->deleteLater();
+    worker = NULL;
+
+    showBudget();
+
+    if (pending)
+        startWorker();
+}
+
+void BudgetWidget::showBudget() {
+    int total = 0;
+
+    for (int i = 0; i < NUM_LEVEL_CHUNKS; i++) {
+        if (budget.packedSize[i] < 0) {
+            unpackedLabels[i]->setText("-");
+            packedLabels[i]->setText("-");
+        } else {
+            unpackedLabels[i]->setText(QString::number(budget.unpacked[i].size()));
+            packedLabels[i]->setText(QString::number(budget.packedSize[i]));
+            total += budget.packedSize[i];
+        }
+    }
+    totalLabel->setText(QString::number(total));
+
+    // show the tilemap size, and make it obvious if it's too big to save the whole thing
+    fieldBar->setValue(qMin(budget.fieldSize, BIG_CHUNK_SIZE));
+    fieldBar->setFormat(tr("%1 / %2 bytes").arg(budget.fieldSize).arg(BIG_CHUNK_SIZE));
+
+    if (budget.fieldSize > BIG_CHUNK_SIZE) {
+        fieldBar->setStyleSheet("QProgressBar::chunk { background-color: red; }");
+        fieldBar->setToolTip(tr("The 3D tilemap is too large; the bottom of it will not be saved.\n"
+                                "Decrease the length, width, and/or height of the course "
+                                "in order to reduce the tilemap size."));
+    } else {
+        fieldBar->setStyleSheet("");
+        fieldBar->setToolTip("");
+    }
+}
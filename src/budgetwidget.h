@@ -0,0 +1,97 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef BUDGETWIDGET_H
+#define BUDGETWIDGET_H
+
+#include <QWidget>
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QList>
+#include <QByteArray>
+#include <QTimer>
+#include <QtWidgets/QLabel>
+#include <QtWidgets/QProgressBar>
+#include "level.h"
+
+// number of chunks returned by makeLevelChunks (the header and chunks 1 to 10)
+#define NUM_LEVEL_CHUNKS 11
+
+/*
+  Sizes of everything that gets saved for a level.
+  The last uncompressed data for each chunk is kept along with the compressed size,
+  so that chunks which haven't changed don't have to be compressed again.
+*/
+typedef struct {
+    int        fieldSize;
+    QByteArray unpacked[NUM_LEVEL_CHUNKS];
+    int        packedSize[NUM_LEVEL_CHUNKS];
+} budget_t;
+
+/*
+  Worker object for calculating a level's budget in the background.
+  Works on its own copy of the level, so the level can keep being edited.
+*/
+class BudgetWorker : public QObject, public QRunnable {
+    Q_OBJECT
+
+public:
+    BudgetWorker(const leveldata_t *level, const budget_t &last);
+
+    void run();
+
+    const budget_t& getBudget() const { return budget; }
+
+signals:
+    void finished();
+
+private:
+    leveldata_t level;
+    budget_t    budget;
+};
+
+/*
+  Panel showing how much space the current level takes up when saved
+  (the 3D tilemap size vs. its limit, and the size of each chunk before and after compression.)
+*/
+class BudgetWidget : public QWidget {
+    Q_OBJECT
+
+public:
+    explicit BudgetWidget(QWidget *parent = 0, leveldata_t *currentLevel = 0);
+    ~BudgetWidget();
+
+public slots:
+    // update the budget shortly after the level was changed
+    void refresh();
+
+private slots:
+    void startWorker();
+    void workerFinished();
+
+private:
+    leveldata_t  *level;
+    budget_t     budget;
+
+    // timer for waiting until edits stop before starting the worker
+    QTimer       timer;
+    BudgetWorker *worker;
+    // was the level edited again while the worker was still running?
+    bool         pending;
+    // the worker gets its own thread, so neither closing the window nor saving the ROM
+    // (which waits on the global thread pool) has to wait on anything else
+    QThreadPool  pool;
+
+    QProgressBar *fieldBar;
+    QLabel       *unpackedLabels[NUM_LEVEL_CHUNKS];
+    QLabel       *packedLabels[NUM_LEVEL_CHUNKS];
+    QLabel       *totalLabel;
+
+    void clearBudget();
+    void showBudget();
+};
+
+#endif // BUDGETWIDGET_H
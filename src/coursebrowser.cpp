@@ -0,0 +1,222 @@
+/*
+  coursebrowser.cpp
+
+  Contains the dialog which shows thumbnails of every level in the ROM. The thumbnails are
+  made in the background from copies of the levels, and are cached both in memory and on
+  disk (by a hash of the level's contents), so they only ever have to be made again when a
+  level actually changes. The least recently used thumbnails on disk are deleted once there
+  are too many of them.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QThread>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QPixmap>
+#include <QIcon>
+#include <QtWidgets/QVBoxLayout>
+#include <QtWidgets/QDialogButtonBox>
+
+#include "coursebrowser.h"
+#include "previewrenderer.h"
+#include "kirby.h"
+
+// change this whenever thumbnails start looking different,
+// so that old ones in the disk cache aren't used anymore
+#define THUMB_VERSION 1
+
+ThumbnailWorker::ThumbnailWorker(int num, const leveldata_t *level, const QByteArray &key,
+                                 const QString &fileName)
+    : QObject(),
+      num(num),
+      level(*level),
+      key(key),
+      fileName(fileName)
+{
+    this->setAutoDelete(false);
+}
+
+void ThumbnailWorker::run() {
+    if (image.load(fileName, "PNG")) {
+        // mark it as recently used, so it's one of the last to be deleted
+        QFile file(fileName);
+        if (file.open(QIODevice::Append))
+            file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    } else {
+        Playfield playfield;
+        makeIsometricMap(playfield, &level);
+
+        // (this is already running on its own thread, so don't start any others)
+        PreviewRenderer renderer;
+        image = renderer.render(playfield, &level, true, 1);
+        if (!image.isNull()) {
+            image = image.scaled(THUMB_WIDTH, THUMB_HEIGHT,
+                                 Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            image.save(fileName, "PNG");
+        }
+    }
+
+    emit finished();
+}
+
+CourseBrowser::CourseBrowser(QWidget *parent)
+    : QDialog(parent, Qt::CustomizeWindowHint
+              | Qt::WindowTitleHint
+              | Qt::WindowCloseButtonHint
+              | Qt::WindowMaximizeButtonHint),
+      list(new QListWidget(this)),
+      diskCacheSize(THUMB_CACHE_SIZE)
+{
+    this->setWindowTitle(tr("Browse Courses"));
+    this->resize(8 * (THUMB_WIDTH + 16), 4 * (THUMB_HEIGHT + 32));
+
+    list->setViewMode(QListView::IconMode);
+    list->setMovement(QListView::Static);
+    list->setResizeMode(QListView::Adjust);
+    list->setUniformItemSizes(true);
+    list->setIconSize(QSize(THUMB_WIDTH, THUMB_HEIGHT));
+    list->setGridSize(QSize(THUMB_WIDTH + 16, THUMB_HEIGHT + 32));
+
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel,
+                                                     Qt::Horizontal, this);
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addWidget(list);
+    layout->addWidget(buttons);
+
+    QObject::connect(buttons, SIGNAL(accepted()),
+                     this, SLOT(accept()));
+    QObject::connect(buttons, SIGNAL(rejected()),
+                     this, SLOT(reject()));
+    QObject::connect(list, SIGNAL(itemActivated(QListWidgetItem*)),
+                     this, SLOT(accept()));
+
+    // leave a thread free for everything else
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+
+    thumbnailDir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails/";
+    QDir().mkpath(thumbnailDir);
+}
+
+CourseBrowser::~CourseBrowser() {
+    // don't leave any workers running with nowhere to go
+    pool.clear();
+    pool.waitForDone();
+    qDeleteAll(workers);
+}
+
+int CourseBrowser::select(int level, leveldata_t **levels, ROMFile::game_e game) {
+    int count = numLevels[game];
+    keys.resize(count);
+
+    // (re)fill the list, keeping any thumbnails that are already there
+    while (list->count() > count)
+        delete list->takeItem(list->count() - 1);
+
+    for (int i = 0; i < count; i++) {
+        if (i >= list->count())
+            list->addItem(new QListWidgetItem());
+
+        QListWidgetItem *item = list->item(i);
+        item->setText(QString("%1-%2").arg((i / 8) + 1).arg((i % 8) + 1));
+        item->setToolTip(QString("%1 %2").arg(courseNames[game][i / 8]).arg((i % 8) + 1));
+
+        // only levels which have changed since last time need new thumbnails
+        QByteArray key = levelHash(levels[i]);
+        if (key == keys[i] && !item->icon().isNull())
+            continue;
+        keys[i] = key;
+
+        if (thumbnails.contains(key)) {
+            setThumbnail(i, thumbnails.value(key));
+        } else {
+            item->setIcon(QIcon());
+
+            if (!workers.contains(key)) {
+                QString fileName = QString("%1%2-%3.png").arg(thumbnailDir).arg(THUMB_VERSION)
+                                                        .arg(QString(key.toHex()));
+                ThumbnailWorker *worker = new ThumbnailWorker(i, levels[i], key, fileName);
+                QObject::connect(worker, SIGNAL(finished()),
+                                 this, SLOT(workerFinished()));
+                workers.insert(key, worker);
+                pool.start(worker);
+            }
+        }
+    }
+
+    // forget thumbnails of levels which have changed since then
+    QHash<QByteArray, QImage>::iterator i = thumbnails.begin();
+    while (i != thumbnails.end()) {
+        if (!keys.contains(i.key()))
+            i = thumbnails.erase(i);
+        else
+            i++;
+    }
+
+    list->setCurrentRow(level);
+    list->scrollToItem(list->currentItem());
+
+    if (this->exec() && list->currentRow() >= 0)
+        return list->currentRow();
+
+    return level;
+}
+
+void CourseBrowser::setDiskCacheSize(qint64 size) {
+    diskCacheSize = size;
+}
+
+/*
+  Deletes thumbnails made by other versions of the editor, and then the least recently
+  used ones until the rest fit in the size limit.
+*/
+void CourseBrowser::pruneDiskCache() {
+    QString prefix = QString("%1-").arg(THUMB_VERSION);
+    // (oldest first)
+    QFileInfoList files = QDir(thumbnailDir).entryInfoList(QStringList("*.png"), QDir::Files,
+                                                           QDir::Time | QDir::Reversed);
+    QFileInfoList current;
+    qint64 total = 0;
+
+    for (const QFileInfo &file: files) {
+        if (file.fileName().startsWith(prefix)) {
+            current.append(file);
+            total += file.size();
+        } else {
+            QFile::remove(file.absoluteFilePath());
+        }
+    }
+
+    for (const QFileInfo &file: current) {
+        if (total <= diskCacheSize) break;
+
+        if (QFile::remove(file.absoluteFilePath()))
+            total -= file.size();
+    }
+}
+
+void CourseBrowser::workerFinished() {
+    ThumbnailWorker *worker = static_cast<ThumbnailWorker*>(sender());
+    workers.remove(worker->getKey());
+
+    if (!worker->getImage().isNull()) {
+        thumbnails.insert(worker->getKey(), worker->getImage());
+
+        // show it for every level that (still) looks like this one
+        for (int i = 0; i < list->count(); i++) {
+            if (keys[i] == worker->getKey())
+                setThumbnail(i, worker->getImage());
+        }
+    }
+
+    worker->deleteLater();
+}
+
+void CourseBrowser::setThumbnail(int num, const QImage &image) {
+    list->item(num)->setIcon(QIcon(QPixmap::fromImage(image)));
+}
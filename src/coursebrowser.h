@@ -0,0 +1,99 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef COURSEBROWSER_H
+#define COURSEBROWSER_H
+
+#include <QDialog>
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QByteArray>
+#include <QString>
+#include <QImage>
+#include <QHash>
+#include <QList>
+#include <QVector>
+#include <QtWidgets/QListWidget>
+#include "level.h"
+#include "romfile.h"
+
+// maximum size of each level's thumbnail
+#define THUMB_WIDTH  192
+#define THUMB_HEIGHT 128
+// default size limit of the thumbnails saved on disk
+#define THUMB_CACHE_SIZE (32 * 1024 * 1024)
+
+/*
+  Worker object for making a level's thumbnail in the background.
+  Loads the thumbnail from the disk cache if it's there; otherwise the level's 3D view is
+  rendered, shrunk down and saved to the disk cache.
+*/
+class ThumbnailWorker : public QObject, public QRunnable {
+    Q_OBJECT
+
+public:
+    ThumbnailWorker(int num, const leveldata_t *level, const QByteArray &key,
+                    const QString &fileName);
+
+    void run();
+
+    int               getNum() const { return num; }
+    const QByteArray& getKey() const { return key; }
+    const QImage&     getImage() const { return image; }
+
+signals:
+    void finished();
+
+private:
+    int         num;
+    leveldata_t level;
+    QByteArray  key;
+    QString     fileName;
+    QImage      image;
+};
+
+/*
+  Dialog showing thumbnails of every level, for picking one to edit.
+  Thumbnails are kept (by the hash of each level) for as long as the dialog exists,
+  so only levels which have changed since the last time need new ones.
+*/
+class CourseBrowser : public QDialog {
+    Q_OBJECT
+
+public:
+    explicit CourseBrowser(QWidget *parent = 0);
+    ~CourseBrowser();
+
+    // show thumbnails of every level in the game and return the one selected
+    // (or the current one, if nothing was)
+    int select(int level, leveldata_t **levels, ROMFile::game_e game = ROMFile::kirby);
+
+    // delete old thumbnails from the disk until it fits in the size limit
+    void pruneDiskCache();
+    void setDiskCacheSize(qint64 size);
+
+private slots:
+    void workerFinished();
+
+private:
+    QListWidget *list;
+
+    // the hash of each level as of the last time the browser was opened
+    QVector<QByteArray> keys;
+    // finished thumbnails by level hash
+    QHash<QByteArray, QImage> thumbnails;
+
+    // running workers by level hash
+    QHash<QByteArray, ThumbnailWorker*> workers;
+    QThreadPool pool;
+
+    QString thumbnailDir;
+    qint64  diskCacheSize;
+
+    void setThumbnail(int num, const QImage &image);
+};
+
+#endif // COURSEBROWSER_H
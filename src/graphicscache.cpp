@@ -0,0 +1,85 @@
+/*
+  graphicscache.cpp
+
+  Contains the cache which holds every image resource after it's been decoded once.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtAlgorithms>
+
+#include "graphicscache.h"
+
+typedef struct graphicscache_s {
+    QMutex                     mutex;
+    QHash<QString, QImage>     images;
+    QHash<QString, QPixmap>    pixmaps;
+    QHash<QString, TileAtlas*> atlases;
+
+    ~graphicscache_s() { qDeleteAll(atlases); }
+} graphicscache_t;
+
+Q_GLOBAL_STATIC(graphicscache_t, cache)
+
+QImage GraphicsCache::image(const QString &fileName) {
+    QMutexLocker lock(&cache()->mutex);
+
+    if (!cache()->images.contains(fileName)) {
+        QImage image(fileName);
+        if (!image.isNull())
+            image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+        cache()->images.insert(fileName, image);
+    }
+
+    return cache()->images.value(fileName);
+}
+
+QPixmap GraphicsCache::pixmap(const QString &fileName) {
+    // pixmaps are only made on the GUI thread, but memoryUsage() can be called from anywhere,
+    // so the hash is still locked (just not while the image is being loaded)
+    {
+        QMutexLocker lock(&cache()->mutex);
+        if (cache()->pixmaps.contains(fileName))
+            return cache()->pixmaps.value(fileName);
+    }
+
+    QPixmap pixmap = QPixmap::fromImage(image(fileName));
+
+    QMutexLocker lock(&cache()->mutex);
+    cache()->pixmaps.insert(fileName, pixmap);
+
+    return pixmap;
+}
+
+const TileAtlas& GraphicsCache::atlas(const QString &fileName) {
+    QMutexLocker lock(&cache()->mutex);
+
+    TileAtlas *atlas = cache()->atlases.value(fileName);
+    if (!atlas) {
+        atlas = new TileAtlas();
+        atlas->load(fileName);
+
+        cache()->atlases.insert(fileName, atlas);
+    }
+
+    return *atlas;
+}
+
+size_t GraphicsCache::memoryUsage() {
+    QMutexLocker lock(&cache()->mutex);
+    size_t total = 0;
+
+    for (const QImage &image: cache()->images)
+        total += image.sizeInBytes();
+    for (const QPixmap &pixmap: cache()->pixmaps)
+        total += (size_t)pixmap.width() * pixmap.height() * pixmap.depth() / 8;
+    for (const TileAtlas *atlas: cache()->atlases)
+        total += atlas->image().sizeInBytes();
+
+    return total;
+}
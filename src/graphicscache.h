@@ -0,0 +1,35 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef GRAPHICSCACHE_H
+#define GRAPHICSCACHE_H
+
+#include <cstddef>
+#include <QString>
+#include <QImage>
+#include <QPixmap>
+#include "tileatlas.h"
+
+/*
+  Process-wide cache of the graphics used by the 2D map, the 3D preview and anything else
+  that draws levels, so each image resource is only decoded once.
+
+  Images are decoded as ARGB32_Premultiplied (the format the renderers use) and can be
+  requested from any thread. Pixmaps are made from the cached images and, like any other
+  pixmap, can only be used from the GUI thread.
+*/
+class GraphicsCache {
+public:
+    static QImage           image(const QString &fileName);
+    static QPixmap          pixmap(const QString &fileName);
+    // a 3D tile sheet with all of its flipped tiles (see tileatlas.h)
+    // the atlas stays around until the program exits
+    static const TileAtlas& atlas(const QString &fileName);
+
+    // approximate amount of memory used by all cached graphics
+    static size_t           memoryUsage();
+};
+
+#endif // GRAPHICSCACHE_H
@@ -21,6 +21,9 @@
 
 #include <QString>
 #include <QCoreApplication>
+#include <QSemaphore>
+#include <QVector>
+#include <QCryptographicHash>
 
 using namespace stuff;
 
@@ -49,18 +52,98 @@ const uint newDataAddress[] = {0xa88000, 0xa08000, 0xa08000, 0xa08000};
 // blank tile used for rendering playfield
 const maptile_t noTile = {0, 0, 0, {0, 0, 0, 0, 0, 0}};
 
+/*
+  Everything needed to draw one tile of the 2D map onto the isometric tile map.
+*/
+typedef struct {
+    // which 2D map tile this is (see Playfield::owner)
+    uint16_t owner;
+    int z, startX, startY, startYObs;
+    metatile_t meta, obs;
+    int terrainLayer, terrainLeftLayer, terrainRightLayer;
+    int leftEdgeSize, rightEdgeSize;
+    int leftBaseHeight, rightBaseHeight;
+} isotile_t;
+
+
+/*
+  Adds (delta = 1) or removes (delta = -1) one tile's part of the level statistics.
+*/
+static void countTile(levelstats_t &stats, uint x, uint y, const maptile_t &tile, int delta) {
+    stats.heights[tile.height]     += delta;
+    stats.obstacles[tile.obstacle] += delta;
+    if (tile.obstacle >= water && tile.obstacle < endWater)
+        stats.water += delta;
+
+    if (tile.geometry) {
+        stats.rows[y] += delta;
+        stats.cols[x] += delta;
+    }
+
+    if (delta > 0) {
+        stats.maxHeight = qMax(stats.maxHeight, (int)tile.height);
+        if (tile.geometry) {
+            stats.left   = qMin(stats.left,   (int)x);
+            stats.top    = qMin(stats.top,    (int)y);
+            stats.right  = qMax(stats.right,  (int)x);
+            stats.bottom = qMax(stats.bottom, (int)y);
+        }
+    }
+}
+
+/*
+  Shrinks the maximum height and the bounding box after tiles have been removed.
+  (this only looks at as many heights/rows/columns as there are empty ones at the edges)
+*/
+static void trimStats(levelstats_t &stats) {
+    while (stats.maxHeight > 0 && !stats.heights[stats.maxHeight])
+        stats.maxHeight--;
+
+    while (stats.top <= stats.bottom && !stats.rows[stats.top])
+        stats.top++;
+    while (stats.bottom >= stats.top && !stats.rows[stats.bottom])
+        stats.bottom--;
+    while (stats.left <= stats.right && !stats.cols[stats.left])
+        stats.left++;
+    while (stats.right >= stats.left && !stats.cols[stats.right])
+        stats.right--;
+}
+
+void updateLevelStats(leveldata_t *level) {
+    levelstats_t &stats = level->stats;
+
+    memset(&stats, 0, sizeof(levelstats_t));
+    stats.left = stats.top = MAX_2D_SIZE;
+    stats.right = stats.bottom = -1;
+
+    for (uint y = 0; y < level->header.length && y < MAX_2D_SIZE; y++)
+        for (uint x = 0; x < level->header.width && x < MAX_2D_SIZE; x++)
+            countTile(stats, x, y, level->tiles[y][x], 1);
+}
+
+void setTile(leveldata_t *level, uint x, uint y, const maptile_t &tile) {
+    if (x >= MAX_2D_SIZE || y >= MAX_2D_SIZE) return;
+
+    // tiles outside of the level's area don't count
+    // (until the level is resized and updateLevelStats is called)
+    bool inside = x < level->header.width && y < level->header.length;
+
+    if (inside)
+        countTile(level->stats, x, y, level->tiles[y][x], -1);
+
+    level->tiles[y][x] = tile;
+
+    if (inside) {
+        countTile(level->stats, x, y, tile, 1);
+        trimStats(level->stats);
+    }
+}
 
 /*
   Returns the maximum tile height of a level.
 */
 uint levelHeight(const leveldata_t *level) {
-    int h = 0;
-    for (int i = 0; i < level->header.length; i++)
-        for (int j = 0; j < level->header.width; j++)
-            if (level->tiles[i][j].height > h)
-                h = level->tiles[i][j].height;
-
-    return h;
+    return level->stats.maxHeight;
 }
 
 /*
@@ -68,13 +151,30 @@ uint levelHeight(const leveldata_t *level) {
   Used to determine which tiles to use (conveyor belts or water).
 */
 bool waterLevel(const leveldata_t *level) {
-    for (int i = 0; i < level->header.length; i++)
-        for (int j = 0; j < level->header.width; j++)
-            if (level->tiles[i][j].obstacle >= water
-                    && level->tiles[i][j].obstacle < endWater)
-                return true;
+    return level->stats.water > 0;
+}
+
+QRect levelBounds(const leveldata_t *level) {
+    const levelstats_t &stats = level->stats;
+
+    if (stats.top > stats.bottom)
+        return QRect();
+    return QRect(QPoint(stats.left, stats.top), QPoint(stats.right, stats.bottom));
+}
+
+uint obstacleCount(const leveldata_t *level, uint obstacle) {
+    return obstacle < 256 ? level->stats.obstacles[obstacle] : 0;
+}
+
+QByteArray levelHash(const leveldata_t *level) {
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    uint16_t size[2] = {level->header.width, level->header.length};
+
+    hash.addData((const char*)size, sizeof(size));
+    for (int y = 0; y < level->header.length; y++)
+        hash.addData((const char*)level->tiles[y], level->header.width * sizeof(maptile_t));
 
-    return false;
+    return hash.result();
 }
 
 /*
@@ -126,6 +226,7 @@ leveldata_t* loadLevel (ROMFile& file, uint num) {
         // to allow the user to continue editing.
         level->header.length = 10;
         level->header.width  = 10;
+        updateLevelStats(level);
 
         return level;
     }
@@ -164,17 +265,18 @@ leveldata_t* loadLevel (ROMFile& file, uint num) {
         }
     }
 
+    updateLevelStats(level);
     return level;
 }
 
 /*
- * New version of saveLevel that returns a list of chunks
+ * Builds the uncompressed data for each chunk of a level (the header, chunks 1 to 10)
+ * in the order they are saved in. The header is not compressed; everything else is.
  */
-QList<QByteArray*> saveLevel(leveldata_t *level, int *fieldSize) {
-    // buffers for compressed and uncompressed data
-    uint8_t packed[CHUNK_SIZE], unpacked[CHUNK_SIZE];
-    size_t packedSize = 0;
-    QList<QByteArray*> chunks;
+QList<QByteArray> makeLevelChunks(leveldata_t *level, int *fieldSize) {
+    // buffer for uncompressed data
+    uint8_t unpacked[CHUNK_SIZE];
+    QList<QByteArray> chunks;
 
     // level length, width
     int length = level->header.length;
@@ -195,37 +297,34 @@ QList<QByteArray*> saveLevel(leveldata_t *level, int *fieldSize) {
     level->header.dummy1 = 0xFFFF;
     level->header.dummy2 = 0xFFFF;
 
-    chunks.append(new QByteArray((const char*)&level->header, sizeof(header_t)));
+    chunks.append(QByteArray((const char*)&level->header, sizeof(header_t)));
 
-    // step 2: compress and save terrain in chunk 1
+    // step 2: save terrain in chunk 1
     // build uncompressed data buffer from terrain data
     // (remember, levels are stored bottom-up)
     for (int y = 0; y < length; y++)
         for (int x = 0; x < width; x++)
             unpacked[y * width + x] = level->tiles[length - y - 1][x].geometry;
 
-    packedSize = pack(unpacked, length * width, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    chunks.append(QByteArray((const char*)unpacked, length * width));
 
-    // step 3: compress and save obstacles in chunk 2
+    // step 3: save obstacles in chunk 2
     // build uncompressed data buffer from obstacle data
     for (int y = 0; y < length; y++)
         for (int x = 0; x < width; x++)
             unpacked[y * width + x] = level->tiles[length - y - 1][x].obstacle;
 
-    packedSize = pack(unpacked, length * width, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    chunks.append(QByteArray((const char*)unpacked, length * width));
 
-    // step 4: compress and save heights in chunk 3
+    // step 4: save heights in chunk 3
     // build uncompressed data buffer from terrain data
     for (int y = 0; y < length; y++)
         for (int x = 0; x < width; x++)
             unpacked[y * width + x] = level->tiles[length - y - 1][x].height;
 
-    packedSize = pack(unpacked, length * width, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    chunks.append(QByteArray((const char*)unpacked, length * width));
 
-    // step 5: compress and save flags in chunk 4
+    // step 5: save flags in chunk 4
     // build uncompressed data buffer from terrain data
     for (int y = 0; y < length; y++)
         for (int x = 0; x < width; x++)
@@ -234,11 +333,10 @@ QList<QByteArray*> saveLevel(leveldata_t *level, int *fieldSize) {
                    1);
             //unpacked[y * width + x] = level->tiles[length - y - 1][x].flags;
 
-    packedSize = pack(unpacked, length * width, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    chunks.append(QByteArray((const char*)unpacked, length * width));
 
-    // step 6: create packed playfield tilemaps and write them
-    auto playfield = new uint16_t[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH];
+    // step 6: create packed playfield tilemaps
+    Playfield playfield;
 
     makeIsometricMap(playfield, level);
 
@@ -247,75 +345,55 @@ QList<QByteArray*> saveLevel(leveldata_t *level, int *fieldSize) {
     uint16_t rowOffsets[CHUNK_SIZE / 2] = {0};
 
     uint16_t layer[2][BIG_CHUNK_SIZE / 2] = {{0}};
-    int index = 0;
-    int rowLen = 0;
-
-    // iterate through each row of the playfield to find where the row starts and ends
-    // then copy stuff into the tile buffers
-    for (int row = 0; row < level->header.fieldHeight; row++) {
-        int start, end;
-
-        // find the row start position
-        for (start = 0; start < level->header.fieldWidth; start++)
-            if (TILE(playfield[0][row][start]) != 0
-                    || TILE(playfield[1][row][start]) != 0)
-                break;
-
-        // find the row end position
-        for (end = level->header.fieldWidth - 1; end > start; end--)
-            if (TILE(playfield[0][row][end]) != 0
-                    || TILE(playfield[1][row][end]) != 0)
-                break;
-
-        rowLen = end - start + 1;
-
-        // copy playfield row into pack buffer if there is enough room
-        if (start != level->header.fieldWidth && index + rowLen <= (BIG_CHUNK_SIZE / 2)) {
-            memcpy(&layer[0][index], &(playfield[0][row][start]), rowLen * 2);
-            memcpy(&layer[1][index], &(playfield[1][row][start]), rowLen * 2);
-
-            rowStarts[row]  = start;
-            rowEnds[row]    = end;
-            rowOffsets[row] = index;
-        } else {
-        // otherwise, start writing empty rows of tiles to prevent garbage at the bottom
-            rowStarts[row]  = 0xFFFF;
-            rowEnds[row]    = 0xFFFF;
-            rowOffsets[row] = 0xFFFF;
-        }
-
-        index += rowLen;
-    }
+    uint index = 0;
 
-    delete[] playfield;
+    // the playfield already knows where each row starts and ends,
+    // so just pack the rows into the tile buffers
+    // (rows which don't fit will be empty, to prevent garbage at the bottom)
+    uint fullSize = playfield.pack(rowStarts, rowEnds, rowOffsets,
+                                   layer[0], layer[1],
+                                   BIG_CHUNK_SIZE / 2, &index);
 
     if (fieldSize) {
-        *fieldSize = index * 2;
+        *fieldSize = fullSize * 2;
     }
 
-    index = qMin(index, BIG_CHUNK_SIZE / 2);
+    // step 7: save playfield chunks
+    chunks.append(QByteArray((const char*)&rowStarts[0],  level->header.fieldHeight * 2));
+    chunks.append(QByteArray((const char*)&rowEnds[0],    level->header.fieldHeight * 2));
+    chunks.append(QByteArray((const char*)&rowOffsets[0], level->header.fieldHeight * 2));
+    chunks.append(QByteArray((const char*)&layer[0][0], index * 2));
+    chunks.append(QByteArray((const char*)&layer[1][0], index * 2));
 
-    // step 7: write playfield chunks
-    packedSize = pack((uint8_t*)&rowStarts[0], level->header.fieldHeight * 2, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    // step 8: do clipping table
+    // TODO: update clipping table info based on STS expanded format?
+    QByteArray clipTable(makeClipTable(level), '\0');
+    makeClipTable(level, (uint8_t*)clipTable.data());
+    chunks.append(clipTable);
 
-    packedSize = pack((uint8_t*)&rowEnds[0], level->header.fieldHeight * 2, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    return chunks;
+}
 
-    packedSize = pack((uint8_t*)&rowOffsets[0], level->header.fieldHeight * 2, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+/*
+ * New version of saveLevel that returns a list of chunks
+ */
+QList<QByteArray*> saveLevel(leveldata_t *level, int *fieldSize) {
+    // buffer for compressed data
+    // (this also needs to hold chunks 8 and 9, with some room for data that doesn't
+    // compress well)
+    uint8_t packed[2 * BIG_CHUNK_SIZE];
+    size_t packedSize = 0;
+    QList<QByteArray*> chunks;
 
-    packedSize = pack((uint8_t*)&layer[0][0], index * 2, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    QList<QByteArray> unpacked = makeLevelChunks(level, fieldSize);
 
-    packedSize = pack((uint8_t*)&layer[1][0], index * 2, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    // the header is saved as-is, everything else gets compressed
+    chunks.append(new QByteArray(unpacked[0]));
 
-    // step 8: do clipping table
-    // TODO: update clipping table info based on STS expanded format?
-    size_t clipSize = makeClipTable(level, unpacked);
-    packedSize = pack(unpacked, clipSize, packed, 1);
-    chunks.append(new QByteArray((const char*)packed, packedSize));
+    for (int i = 1; i < unpacked.size(); i++) {
+        packedSize = pack((uint8_t*)unpacked[i].constData(), unpacked[i].size(), packed, 1);
+        chunks.append(new QByteArray((const char*)packed, packedSize));
+    }
 
     return chunks;
 }
@@ -413,90 +491,138 @@ uint saveAllLevels(ROMFile& file, leveldata_t **levels) {
     return addr;
 }
 
+// number of 64-bit words needed for one bit per tile in a row
+#define CLIP_MASK_WORDS ((MAX_2D_SIZE + 63) / 64)
+
 /*
-  Generates a level's Z-clipping table (chunk 10) and puts it into a buffer.
-  Returns the size of the generated chunk.
+  Returns the column of the last non-empty tile before column x in a row,
+  or -1 if there isn't one.
 */
-size_t makeClipTable(const leveldata_t *level, uint8_t *buffer) {
+static int lastTileBefore(const uint64_t *mask, int x) {
+    if (x <= 0) return -1;
+
+    int word = (x - 1) / 64;
+    uint64_t bits = mask[word] & (~0ULL >> (63 - (x - 1) % 64));
+
+    while (!bits) {
+        if (--word < 0) return -1;
+        bits = mask[word];
+    }
+
+#if defined(__GNUC__)
+    return word * 64 + 63 - __builtin_clzll(bits);
+#else
+    int bit = 63;
+    while (!(bits >> bit)) bit--;
+    return word * 64 + bit;
+#endif
+}
+
+/*
+  Finds all of the clipping table entries for a level, in the order they go in the table.
+  If buffer is null, this only counts how many entries go in each part of the table;
+  otherwise each entry is written to the buffer at the position given by offsets
+  (which is advanced past it).
+*/
+static void findClips(const leveldata_t *level, const uint64_t filled[][CLIP_MASK_WORDS],
+                      uint *counts, uint8_t *buffer, uint *offsets) {
     int l = level->header.length;
     int w = level->header.width;
 
-    std::vector<clip_t> *table = new std::vector<clip_t>[l + w];
-
     for (int y = 0; y < l; y++) {
         // the game itself stores tile data "south to north"
         // (and this is important when generating this data)
         int realY = l - y - 1;
         clip_t clip;
 
-        for (int x = w; x > 0; x--) {
+        // go through each non-empty tile from east to west
+        // (except for the westmost column, which never gets clipping entries)
+        for (int x = lastTileBefore(filled[y], w); x > 0; x = lastTileBefore(filled[y], x)) {
             clip.zref = (realY * w) + x;
-            // first, check for a gap to the north
-            if (y > 0 && level->tiles[y][x].geometry > 0
-                    && level->tiles[y - 1][x].geometry == 0) {
-                // how far does the gap go?
-                for (clip.xLower = x; clip.xLower >= 1
-                                   && level->tiles[y - 1][clip.xLower - 1].geometry == 0; clip.xLower--);
+            clip.prio = level->tiles[y][x].flags.layer ? 2 : 1;
 
+            // first, check for a gap to the north (and see how far it goes)
+            if (y > 0 && !(filled[y - 1][x / 64] & (1ULL << (x % 64)))) {
+                clip.xLower = lastTileBefore(filled[y - 1], x) + 1;
                 clip.xUpper = x + 1;
 
-                // set priority
-                clip.prio = level->tiles[y][x].flags.layer ? 2 : 1;
-
-                // add this entry to the table
-                table[realY + x + 1].push_back(clip);
+                int part = realY + x + 1;
+                if (buffer) {
+                    memcpy(&buffer[offsets[part]], &clip, sizeof(clip_t));
+                    offsets[part] += sizeof(clip_t);
+                }
+                counts[part]++;
             }
 
             // next, check for a gap to the west
-            if (x > 0 && level->tiles[y][x].geometry > 0
-                    && level->tiles[y][x - 1].geometry == 0) {
-                // how far does the gap go?
-                for (clip.xLower = x - 1; clip.xLower >= 1
-                                   && level->tiles[y][clip.xLower - 1].geometry == 0; clip.xLower--);
-
+            if (!(filled[y][(x - 1) / 64] & (1ULL << ((x - 1) % 64)))) {
+                clip.xLower = lastTileBefore(filled[y], x) + 1;
                 clip.xUpper = x;
 
-                // set priority
-                clip.prio = level->tiles[y][x].flags.layer ? 2 : 1;
-
-                // add this entry to the table
-                table[realY + x - 1].push_back(clip);
-
-                // skip over the gap that we just checked
-                x = clip.xLower;
+                int part = realY + x - 1;
+                if (buffer) {
+                    memcpy(&buffer[offsets[part]], &clip, sizeof(clip_t));
+                    offsets[part] += sizeof(clip_t);
+                }
+                counts[part]++;
             }
         }
     }
+}
+
+/*
+  Generates a level's Z-clipping table (chunk 10) and puts it into a buffer.
+  Returns the size of the generated chunk. If the buffer is null, nothing is written,
+  but the size is still returned (so the right size of buffer can be used.)
+*/
+size_t makeClipTable(const leveldata_t *level, uint8_t *buffer) {
+    int l = level->header.length;
+    int w = level->header.width;
+
+    // keep track of which tiles in each row are not empty, so that the size of
+    // a gap can be found right away instead of checking one tile at a time
+    uint64_t filled[MAX_2D_SIZE][CLIP_MASK_WORDS] = {{0}};
+    for (int y = 0; y < l; y++)
+        for (int x = 0; x < w; x++)
+            if (level->tiles[y][x].geometry > 0)
+                filled[y][x / 64] |= 1ULL << (x % 64);
+
+    // first, count the entries in each part of the table to find out where they all go
+    uint counts [2 * MAX_2D_SIZE] = {0};
+    uint offsets[2 * MAX_2D_SIZE];
+
+    findClips(level, filled, counts, NULL, NULL);
 
-    //write table into buffer
     uint offset = 2 * (l + w);
-    uint16_t offsets[128];
     for (int i = 0; i < l + w; i++) {
-        std::vector<clip_t>& thisClip = table[i];
-
         // don't care about empty parts of the table
-        uint size = thisClip.size();
-        if (!size) {
+        if (!counts[i]) {
             offsets[i] = 0xFFFF;
             continue;
         }
 
         offsets[i] = offset;
+        offset += 1 + counts[i] * sizeof(clip_t);
+    }
+
+    if (!buffer)
+        return offset;
 
-        // write the number of clip_t in this part
-        buffer[offset++] = (uint8_t)size;
+    // write the table index pointers and the number of clip_t in each part
+    for (int i = 0; i < l + w; i++) {
+        uint16_t ptr = offsets[i];
+        memcpy(&buffer[2 * i], &ptr, 2);
 
-        // write all of the individual clip_t
-        for (uint j = 0; j < size; j++) {
-            memcpy(&(buffer[offset]), &(thisClip[j]), sizeof(clip_t));
-            offset += sizeof(clip_t);
+        if (counts[i]) {
+            buffer[offsets[i]] = (uint8_t)counts[i];
+            offsets[i]++;
+            counts[i] = 0;
         }
     }
 
-    // copy the table index pointers to the beginning of the buffer
-    memcpy(buffer, offsets, 2 * (w + l));
+    // then write all of the individual clip_t
+    findClips(level, filled, counts, buffer, offsets);
 
-    delete[] table;
     return offset;
 }
 
@@ -504,11 +630,334 @@ size_t makeClipTable(const leveldata_t *level, uint8_t *buffer) {
   Builds the 3D metatile map based on the 2D map.
   This needs some serious rewriting. It was pretty much totally improvised, revised,
   revised, revised, revised, and revised again and again until it looked right.
+
+  This is split into two steps: first, figuring out which metatiles, layers etc. to use for
+  a single 2D tile (which only reads from the level and can be done for any number of tiles
+  at once), then actually drawing them onto the playfield in the right order.
 */
-void makeIsometricMap(uint16_t playfield[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH], leveldata_t *level) {
-    // erase the old map
-    memset(playfield, 0, 2*MAX_FIELD_HEIGHT*MAX_FIELD_WIDTH*sizeof(uint16_t));
+static bool buildIsometricTile(const leveldata_t *level, int x, int y, int h, isotile_t *tile) {
+    int l = level->header.length;
+
+    // do not render non-terrain tiles at all
+    if (level->tiles[y][x].geometry == 0) return false;
+
+    maptile_t thisTile, leftTile, rightTile, backTile;
+    bool useExtraTiles = false;
+    thisTile = level->tiles[y][x];
+
+    int z = thisTile.height;
+
+    // horizontal: start at 0 tiles
+    // move 4 right for each positive move on the x-axis (west to east)
+    // and  4 left  for each positive move on the y-axis (north to south)
+    int startX = 4 * (x + (l - y - 1));
+    // start at 2 * h tiles
+    // move 2 down for each positive move on the x-axis (west to east)
+    // and  2 down for each positive move on the y-axis (north to south)
+    // and  2 up   for each positive move on the z-axis (tile z)
+    int startY = 2 * (h + x + y - z);
+
+    // draw obstacles (namely bumpers) lower if on a diagonal slope bottom
+    int startYObs = 0;
+    if (thisTile.geometry >= slopesLower && thisTile.geometry < endSlopesLower)
+        startYObs = 2;
+
+    // figure out which metatiles to use based on the current 2d tile and its neighbors
+    // ("left" is west, "right" is north)
+    if (x > 0)
+        leftTile = level->tiles[y][x-1];
+    else leftTile = noTile;
+    if (y > 0)
+        rightTile = level->tiles[y-1][x];
+    else rightTile = noTile;
+    // backTile is used in some rare cases for obstacles
+    // (spikes, some bounce slopes) where borders have to be removed between
+    // the left and right tiles when there is a 2x2 or bigger area of the same obstacle.
+    if (x > 0 && y > 0)
+        backTile = level->tiles[y-1][x-1];
+    else backTile = noTile;
+    if ((thisTile.obstacle == spikes
+            && thisTile.obstacle == leftTile.obstacle
+            && thisTile.obstacle == rightTile.obstacle
+            && thisTile.obstacle == backTile.obstacle)
+
+     || (thisTile.obstacle == bounceNorth
+            && thisTile.obstacle == leftTile.obstacle
+            && thisTile.obstacle == backTile.obstacle)
+
+     || (thisTile.obstacle == bounceWest
+            && thisTile.obstacle == rightTile.obstacle
+            && thisTile.obstacle == backTile.obstacle)) {
+
+        useExtraTiles = true;
+    }
+
+    // determine whether each edge is touching either a wall or another thing
+    int leftEdge, rightEdge;
+
+    // don't make tile connections when adjacent tiles are on different layers
+    if (thisTile.flags.layer && !leftTile.flags.layer)
+        leftEdge = nothing;
+    else if (leftTile.geometry >= slopes || leftTile.geometry == slopesUp) {
+        // Don't connect slopes that go to the south and/or west
+        if (leftTile.height - thisTile.height > 1
+            || (leftTile.height - thisTile.height == 1
+                && thisTile.geometry < endSlopesUpper
+                && leftTile.geometry != slopeEast
+                && leftTile.geometry != slopeSouthAndEastOuter
+                && leftTile.geometry != slopeNorthAndEastOuter
+                && (leftTile.geometry == slopeNorth
+                    || leftTile.geometry == slopeWest
+                    || leftTile.geometry == slopeSouthAndWestInner
+                    || leftTile.geometry == slopeNorthAndEastInner
+                    || leftTile.geometry == slopeNorthAndWestInner
+                    || leftTile.geometry == slopeNorthAndWestOuter
+                    || leftTile.geometry == slopeSoutheastFull
+                    || leftTile.geometry == slopeNortheastUpper
+                    || leftTile.geometry == slopeNorthwestUpper
+                    || leftTile.geometry == slopeSouthwestUpper
+                    || thisTile.geometry == slopeSouth
+                    || thisTile.geometry == slopeSouthAndEastOuter
+                    || thisTile.geometry == slopeSouthAndWestInner))
+            || (leftTile.height == thisTile.height
+                && thisTile.geometry < slopesFull
+                && leftTile.geometry == slopeSouthwestFull))
+            leftEdge = wall;
+        else leftEdge = leftTile.geometry;
+    }
+    // normal height difference = touching wall
+    else if (leftTile.geometry && leftTile.height > thisTile.height)
+        leftEdge = wall;
+    else leftEdge = leftTile.geometry;
+
+    // same thing, but for right edge
+    if (thisTile.flags.layer && !rightTile.flags.layer)
+        rightEdge = nothing;
+    else if (rightTile.geometry >= slopes || rightTile.geometry == slopesUp) {
+        // Don't connect slopes that go to the north and/or ??
+        if (rightTile.height - thisTile.height > 1
+                || (rightTile.height - thisTile.height == 1
+                    && thisTile.geometry < endSlopesUpper
+                    && rightTile.geometry != slopeSouth
+                    && rightTile.geometry != slopeSouthAndEastOuter
+                    && rightTile.geometry != slopeSouthAndWestOuter
+                    && (rightTile.geometry == slopeNorth
+                        || rightTile.geometry == slopeWest
+                        //|| ??
+                        || rightTile.geometry == slopeNorthAndWestInner
+                        || rightTile.geometry == slopeNorthAndWestOuter
+                        || rightTile.geometry == slopeNorthAndEastInner
+                        || rightTile.geometry == slopeSouthAndWestInner
+                        || rightTile.geometry == slopeNortheastFull
+                        || rightTile.geometry == slopeNortheastUpper
+                        || rightTile.geometry == slopeNorthwestUpper
+                        || rightTile.geometry == slopeSouthwestUpper
+                        || thisTile.geometry == slopeEast
+                        || thisTile.geometry == slopeSouthAndEastOuter
+                        || thisTile.geometry == slopeNorthAndEastInner))
+                || (rightTile.height == thisTile.height
+                    && thisTile.geometry < slopesFull
+                    && rightTile.geometry == slopeNortheastFull))
+            rightEdge = wall;
+        else rightEdge = rightTile.geometry;
+    }
+    // normal height difference = touching wall
+    else if (rightTile.geometry && rightTile.height > thisTile.height)
+        rightEdge = wall;
+    else rightEdge = rightTile.geometry;
+
+    // search through metatile definitions to find ones that match current setup
+    metatile_t meta = buildMetatile(thisTile.geometry, leftEdge, rightEdge,
+                                    thisTile.flags.bumperNorth,
+                                    thisTile.flags.bumperEast,
+                                    thisTile.flags.bumperSouth,
+                                    thisTile.flags.bumperWest,
+    // "northStart" and "westStart" args are used when a tile without bumpers is
+    // adjacent to a tile WITH bumpers, for a couple of cases where using the normal
+    // connection tiles will cause very noticeable gaps in the bumpers (like 3-4?)
+    // in the future I may expand this to handle all such cases for all four bumpers,
+    // but the difference right now is barely noticeable compared to the original game's
+    // tile maps (usually a couple of pixels)
+                                    (!thisTile.flags.bumperNorth && leftTile.flags.bumperNorth),
+                                    (!thisTile.flags.bumperWest  && rightTile.flags.bumperWest)
+                                    );
+
+    leftEdge  = (leftEdge  == wall) ? 0 : leftTile.obstacle;
+    rightEdge = (rightEdge == wall) ? 0 : rightTile.obstacle;
+
+    metatile_t obs;
+    if (useExtraTiles)
+        obs  = buildObstacle(thisTile.obstacle | extraTiles, leftEdge, rightEdge);
+    else
+        obs  = buildObstacle(thisTile.obstacle, leftEdge, rightEdge);
+
+
+    // now lay some tiles down
+    int terrainLayer = thisTile.flags.layer;
+    // Use layer 2 for the left or right edge tiles, if the left or right edge
+    // moves from layer 1 to layer 2. This way the layer 2 tiles will not be
+    // incorrectly drawn on top
+    int terrainLeftLayer  = (thisTile.flags.layer == 0
+                             && leftTile.flags.layer == 1) ? 1 : terrainLayer;
+    int terrainRightLayer = (thisTile.flags.layer == 0
+                             && rightTile.flags.layer == 1) ? 1 : terrainLayer;
+
+    // the edge sizes are used to determine how many rows of tiles to apply
+    // the layer / prio changes to
+    int leftEdgeSize  = 4;
+    int rightEdgeSize = 4;
+
+    if (trueCenterLeftTable[thisTile.geometry] == slopeSouth
+     || trueCenterLeftTable[thisTile.geometry] == slopeSouthAndWestOuter
+     || trueCenterLeftTable[thisTile.geometry] == slopeSouthAndWestInner)
+        leftEdgeSize = 6;
+
+    if (trueCenterRightTable[thisTile.geometry] == slopeEast
+     || trueCenterRightTable[thisTile.geometry] == slopeNorthAndEastOuter
+     || trueCenterRightTable[thisTile.geometry] == slopeNorthAndEastInner)
+        rightEdgeSize = 6;
+
+    // first, do base/height tiles
+    int leftBaseHeight = z + 1;
+    // restrict drawing of support tiles for layer 2 when necessary
+    // so that layer 2's support tiles aren't drawn on top of layer 1 tiles
+    // to the southeast
+    if (level->header.length > y + 1 && level->tiles[y + 1][x].geometry) {
+        leftBaseHeight = z - level->tiles[y+1][x].height + 1;
+
+        // if going layer 1->2 then slopes = more
+        if ((thisTile.flags.layer < level->tiles[y + 1][x].flags.layer)
+                && (level->tiles[y + 1][x].geometry >= slopes))
+            leftBaseHeight++;
+
+        // if going layer 2->1, don't draw as much
+        else if (thisTile.flags.layer && !level->tiles[y + 1][x].flags.layer)
+            leftBaseHeight--;
+    }
+
+    int rightBaseHeight = z + 1;
+    if (level->header.width > x + 1 && level->tiles[y][x + 1].geometry) {
+        rightBaseHeight = z - level->tiles[y][x+1].height + 1;
+
+        // if going layer 1->2 then slopes = more
+        if ((thisTile.flags.layer < level->tiles[y][x + 1].flags.layer)
+                && (level->tiles[y][x + 1].geometry >= slopes))
+            rightBaseHeight++;
 
+        // if going layer 2->1, don't draw as much
+        else if (thisTile.flags.layer && !level->tiles[y][x + 1].flags.layer)
+            rightBaseHeight--;
+    }
+
+    tile->owner             = y * MAX_2D_SIZE + x + 1;
+    tile->z                 = z;
+    tile->startX            = startX;
+    tile->startY            = startY;
+    tile->startYObs         = startYObs;
+    tile->meta              = meta;
+    tile->obs               = obs;
+    tile->terrainLayer      = terrainLayer;
+    tile->terrainLeftLayer  = terrainLeftLayer;
+    tile->terrainRightLayer = terrainRightLayer;
+    tile->leftEdgeSize      = leftEdgeSize;
+    tile->rightEdgeSize     = rightEdgeSize;
+    tile->leftBaseHeight    = leftBaseHeight;
+    tile->rightBaseHeight   = rightBaseHeight;
+
+    return true;
+}
+
+static void drawIsometricTile(Playfield &playfield, const isotile_t &tile) {
+    int z         = tile.z;
+    int startX    = tile.startX;
+    int startY    = tile.startY;
+    int startYObs = tile.startYObs;
+
+    const metatile_t &meta = tile.meta;
+    const metatile_t &obs  = tile.obs;
+
+    int terrainLayer      = tile.terrainLayer;
+    int terrainLeftLayer  = tile.terrainLeftLayer;
+    int terrainRightLayer = tile.terrainRightLayer;
+
+    int terrainPrio      = terrainLayer      ? PRI : 0;
+    int terrainLeftPrio  = terrainLeftLayer  ? PRI : 0;
+    int terrainRightPrio = terrainRightLayer ? PRI : 0;
+
+    int leftEdgeSize    = tile.leftEdgeSize;
+    int rightEdgeSize   = tile.rightEdgeSize;
+    int leftBaseHeight  = tile.leftBaseHeight;
+    int rightBaseHeight = tile.rightBaseHeight;
+
+    // do the height tiles
+    for (int tileY = 2; tileY <= (2 * leftBaseHeight) || tileY < (2 * rightBaseHeight); tileY += 2)
+        for (int tileX = 0; tileX < 4; tileX++) {
+            // left side
+            if (tileY <= 2 * leftBaseHeight) {
+                playfield.set(terrainLayer, startY + 4 + tileY, startX + tileX,
+                              stackTile[0][tileX] | terrainPrio, tile.owner);
+                playfield.set(terrainLayer, startY + 5 + tileY, startX + tileX,
+                              stackTile[1][tileX] | terrainPrio, tile.owner);
+            }
+            // right side
+            if (tileY <= 2 * rightBaseHeight) {
+                playfield.set(terrainLayer, startY + 4 + tileY, startX + 4 + tileX,
+                              stackTile[0][tileX + 4] | terrainPrio, tile.owner);
+                playfield.set(terrainLayer, startY + 5 + tileY, startX + 4 + tileX,
+                              stackTile[1][tileX + 4] | terrainPrio, tile.owner);
+            }
+        }
+    // draw the base tiles
+    if ((leftBaseHeight == z + 1) || (rightBaseHeight == z + 1))
+    for (int tileX = 0; tileX < 4; tileX++) {
+        // left side
+        if (leftBaseHeight == z + 1) {
+            playfield.set(terrainLayer, startY + 6 + (2 * z), startX + tileX,
+                          bottomTile[0][tileX] | terrainPrio, tile.owner);
+            playfield.set(terrainLayer, startY + 7 + (2 * z), startX + tileX,
+                          bottomTile[1][tileX] | terrainPrio, tile.owner);
+        }
+        // right side
+        if (rightBaseHeight == z + 1) {
+            playfield.set(terrainLayer, startY + 6 + (2 * z), startX + tileX + 4,
+                          bottomTile[0][tileX + 4] | terrainPrio, tile.owner);
+            playfield.set(terrainLayer, startY + 7 + (2 * z), startX + tileX + 4,
+                          bottomTile[1][tileX + 4] | terrainPrio, tile.owner);
+        }
+    }
+
+    // now the actual tile itself
+    for (int tileY = 0; tileY < 8; tileY++)
+        for (int tileX = 0; tileX < 8; tileX++) {
+            int layer, prio;
+
+            if (tileY < leftEdgeSize && tileX < 4) {
+                layer = terrainLeftLayer;
+                prio = terrainLeftPrio;
+            } else if (tileY < rightEdgeSize) {
+                layer = terrainRightLayer;
+                prio = terrainRightPrio;
+            } else {
+                layer = terrainLayer;
+                prio = terrainPrio;
+            }
+
+            if (TILE(meta.tiles[tileY][tileX]))
+                playfield.set(layer, startY + tileY, startX + tileX,
+                              meta.tiles[tileY][tileX] | prio, tile.owner);
+
+            if (TILE(obs.tiles[tileY][tileX]))
+              playfield.set(layer ^ 1, startY + startYObs + tileY, startX + tileX,
+                            obs.tiles[tileY][tileX] | PRI, tile.owner);
+
+        }
+}
+
+/*
+  Sets up the playfield size in the level header and clears the playfield.
+  Returns the level's maximum height.
+*/
+static int startIsometricMap(Playfield &playfield, leveldata_t *level) {
     int h = levelHeight(level);
     int l = level->header.length;
     int w = level->header.width;
@@ -516,287 +965,104 @@ void makeIsometricMap(uint16_t playfield[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH],
     level->header.fieldHeight = qMin(MAX_FIELD_HEIGHT, 2 * (h + w + l + 2));
     level->header.fieldWidth  = qMin(MAX_FIELD_WIDTH, 4 * (w + l));
 
+    // erase the old map
+    playfield.clear(level->header.fieldWidth, level->header.fieldHeight);
+
+    return h;
+}
+
+void makeIsometricMap(Playfield &playfield, leveldata_t *level) {
+    int h = startIsometricMap(playfield, level);
+
     // render "back to front" - that is, from north to south, west to east
     for (int x = 0; x < level->header.width; x++) {
         for (int y = 0; y < level->header.length; y++) {
+            isotile_t tile;
 
-            // do not render non-terrain tiles at all
-            if (level->tiles[y][x].geometry == 0) continue;
-
-            maptile_t thisTile, leftTile, rightTile, backTile;
-            bool useExtraTiles = false;
-            thisTile = level->tiles[y][x];
-
-            int z = thisTile.height;
-
-            // horizontal: start at 0 tiles
-            // move 4 right for each positive move on the x-axis (west to east)
-            // and  4 left  for each positive move on the y-axis (north to south)
-            int startX = 4 * (x + (l - y - 1));
-            // start at 2 * h tiles
-            // move 2 down for each positive move on the x-axis (west to east)
-            // and  2 down for each positive move on the y-axis (north to south)
-            // and  2 up   for each positive move on the z-axis (tile z)
-            int startY = 2 * (h + x + y - z);
-
-            // draw obstacles (namely bumpers) lower if on a diagonal slope bottom
-            int startYObs = 0;
-            if (thisTile.geometry >= slopesLower && thisTile.geometry < endSlopesLower)
-                startYObs = 2;
-
-            // figure out which metatiles to use based on the current 2d tile and its neighbors
-            // ("left" is west, "right" is north)
-            if (x > 0)
-                leftTile = level->tiles[y][x-1];
-            else leftTile = noTile;
-            if (y > 0)
-                rightTile = level->tiles[y-1][x];
-            else rightTile = noTile;
-            // backTile is used in some rare cases for obstacles
-            // (spikes, some bounce slopes) where borders have to be removed between
-            // the left and right tiles when there is a 2x2 or bigger area of the same obstacle.
-            if (x > 0 && y > 0)
-                backTile = level->tiles[y-1][x-1];
-            else backTile = noTile;
-            if ((thisTile.obstacle == spikes
-                    && thisTile.obstacle == leftTile.obstacle
-                    && thisTile.obstacle == rightTile.obstacle
-                    && thisTile.obstacle == backTile.obstacle)
-
-             || (thisTile.obstacle == bounceNorth
-                    && thisTile.obstacle == leftTile.obstacle
-                    && thisTile.obstacle == backTile.obstacle)
-
-             || (thisTile.obstacle == bounceWest
-                    && thisTile.obstacle == rightTile.obstacle
-                    && thisTile.obstacle == backTile.obstacle)) {
-
-                useExtraTiles = true;
-            }
+            if (buildIsometricTile(level, x, y, h, &tile))
+                drawIsometricTile(playfield, tile);
+        }
+    }
+}
 
-            // determine whether each edge is touching either a wall or another thing
-            int leftEdge, rightEdge;
-
-            // don't make tile connections when adjacent tiles are on different layers
-            if (thisTile.flags.layer && !leftTile.flags.layer)
-                leftEdge = nothing;
-            else if (leftTile.geometry >= slopes || leftTile.geometry == slopesUp) {
-                // Don't connect slopes that go to the south and/or west
-                if (leftTile.height - thisTile.height > 1
-                    || (leftTile.height - thisTile.height == 1
-                        && thisTile.geometry < endSlopesUpper
-                        && leftTile.geometry != slopeEast
-                        && leftTile.geometry != slopeSouthAndEastOuter
-                        && leftTile.geometry != slopeNorthAndEastOuter
-                        && (leftTile.geometry == slopeNorth
-                            || leftTile.geometry == slopeWest
-                            || leftTile.geometry == slopeSouthAndWestInner
-                            || leftTile.geometry == slopeNorthAndEastInner
-                            || leftTile.geometry == slopeNorthAndWestInner
-                            || leftTile.geometry == slopeNorthAndWestOuter
-                            || leftTile.geometry == slopeSoutheastFull
-                            || leftTile.geometry == slopeNortheastUpper
-                            || leftTile.geometry == slopeNorthwestUpper
-                            || leftTile.geometry == slopeSouthwestUpper
-                            || thisTile.geometry == slopeSouth
-                            || thisTile.geometry == slopeSouthAndEastOuter
-                            || thisTile.geometry == slopeSouthAndWestInner))
-                    || (leftTile.height == thisTile.height
-                        && thisTile.geometry < slopesFull
-                        && leftTile.geometry == slopeSouthwestFull))
-                    leftEdge = wall;
-                else leftEdge = leftTile.geometry;
-            }
-            // normal height difference = touching wall
-            else if (leftTile.geometry && leftTile.height > thisTile.height)
-                leftEdge = wall;
-            else leftEdge = leftTile.geometry;
-
-            // same thing, but for right edge
-            if (thisTile.flags.layer && !rightTile.flags.layer)
-                rightEdge = nothing;
-            else if (rightTile.geometry >= slopes || rightTile.geometry == slopesUp) {
-                // Don't connect slopes that go to the north and/or ??
-                if (rightTile.height - thisTile.height > 1
-                        || (rightTile.height - thisTile.height == 1
-                            && thisTile.geometry < endSlopesUpper
-                            && rightTile.geometry != slopeSouth
-                            && rightTile.geometry != slopeSouthAndEastOuter
-                            && rightTile.geometry != slopeSouthAndWestOuter
-                            && (rightTile.geometry == slopeNorth
-                                || rightTile.geometry == slopeWest
-                                //|| ??
-                                || rightTile.geometry == slopeNorthAndWestInner
-                                || rightTile.geometry == slopeNorthAndWestOuter
-                                || rightTile.geometry == slopeNorthAndEastInner
-                                || rightTile.geometry == slopeSouthAndWestInner
-                                || rightTile.geometry == slopeNortheastFull
-                                || rightTile.geometry == slopeNortheastUpper
-                                || rightTile.geometry == slopeNorthwestUpper
-                                || rightTile.geometry == slopeSouthwestUpper
-                                || thisTile.geometry == slopeEast
-                                || thisTile.geometry == slopeSouthAndEastOuter
-                                || thisTile.geometry == slopeNorthAndEastInner))
-                        || (rightTile.height == thisTile.height
-                            && thisTile.geometry < slopesFull
-                            && rightTile.geometry == slopeNortheastFull))
-                    rightEdge = wall;
-                else rightEdge = rightTile.geometry;
-            }
-            // normal height difference = touching wall
-            else if (rightTile.geometry && rightTile.height > thisTile.height)
-                rightEdge = wall;
-            else rightEdge = rightTile.geometry;
-
-            // search through metatile definitions to find ones that match current setup
-            metatile_t meta = buildMetatile(thisTile.geometry, leftEdge, rightEdge,
-                                            thisTile.flags.bumperNorth,
-                                            thisTile.flags.bumperEast,
-                                            thisTile.flags.bumperSouth,
-                                            thisTile.flags.bumperWest,
-            // "northStart" and "westStart" args are used when a tile without bumpers is
-            // adjacent to a tile WITH bumpers, for a couple of cases where using the normal
-            // connection tiles will cause very noticeable gaps in the bumpers (like 3-4?)
-            // in the future I may expand this to handle all such cases for all four bumpers,
-            // but the difference right now is barely noticeable compared to the original game's
-            // tile maps (usually a couple of pixels)
-                                            (!thisTile.flags.bumperNorth && leftTile.flags.bumperNorth),
-                                            (!thisTile.flags.bumperWest  && rightTile.flags.bumperWest)
-                                            );
-
-            leftEdge  = (leftEdge  == wall) ? 0 : leftTile.obstacle;
-            rightEdge = (rightEdge == wall) ? 0 : rightTile.obstacle;
-
-            metatile_t obs;
-            if (useExtraTiles)
-                obs  = buildObstacle(thisTile.obstacle | extraTiles, leftEdge, rightEdge);
-            else
-                obs  = buildObstacle(thisTile.obstacle, leftEdge, rightEdge);
-
-
-            // now lay some tiles down
-            int terrainLayer = thisTile.flags.layer;
-            // Use layer 2 for the left or right edge tiles, if the left or right edge
-            // moves from layer 1 to layer 2. This way the layer 2 tiles will not be
-            // incorrectly drawn on top
-            int terrainLeftLayer  = (thisTile.flags.layer == 0
-                                     && leftTile.flags.layer == 1) ? 1 : terrainLayer;
-            int terrainRightLayer = (thisTile.flags.layer == 0
-                                     && rightTile.flags.layer == 1) ? 1 : terrainLayer;
-
-            int terrainPrio      = terrainLayer      ? PRI : 0;
-            int terrainLeftPrio  = terrainLeftLayer  ? PRI : 0;
-            int terrainRightPrio = terrainRightLayer ? PRI : 0;
-
-            // the edge sizes are used to determine how many rows of tiles to apply
-            // the layer / prio changes to
-            int leftEdgeSize  = 4;
-            int rightEdgeSize = 4;
-
-            if (trueCenterLeftTable[thisTile.geometry] == slopeSouth
-             || trueCenterLeftTable[thisTile.geometry] == slopeSouthAndWestOuter
-             || trueCenterLeftTable[thisTile.geometry] == slopeSouthAndWestInner)
-                leftEdgeSize = 6;
-
-            if (trueCenterRightTable[thisTile.geometry] == slopeEast
-             || trueCenterRightTable[thisTile.geometry] == slopeNorthAndEastOuter
-             || trueCenterRightTable[thisTile.geometry] == slopeNorthAndEastInner)
-                rightEdgeSize = 6;
-
-            // first, do base/height tiles
-            int leftBaseHeight = z + 1;
-            // restrict drawing of support tiles for layer 2 when necessary
-            // so that layer 2's support tiles aren't drawn on top of layer 1 tiles
-            // to the southeast
-            if (level->header.length > y + 1 && level->tiles[y + 1][x].geometry) {
-                leftBaseHeight = z - level->tiles[y+1][x].height + 1;
-
-                // if going layer 1->2 then slopes = more
-                if ((thisTile.flags.layer < level->tiles[y + 1][x].flags.layer)
-                        && (level->tiles[y + 1][x].geometry >= slopes))
-                    leftBaseHeight++;
-
-                // if going layer 2->1, don't draw as much
-                else if (thisTile.flags.layer && !level->tiles[y + 1][x].flags.layer)
-                    leftBaseHeight--;
-            }
+/*
+  Worker object for building the metatiles for a range of columns of the 2D map
+  (used by makeIsometricMapParallel)
+*/
+class IsoTileWorker : public QRunnable {
 
-            int rightBaseHeight = z + 1;
-            if (level->header.width > x + 1 && level->tiles[y][x + 1].geometry) {
-                rightBaseHeight = z - level->tiles[y][x+1].height + 1;
+public:
+    IsoTileWorker(const leveldata_t *level, int h, int firstX, int lastX,
+                  isotile_t *tiles, bool *used, QSemaphore *done)
+        : level(level), h(h), firstX(firstX), lastX(lastX),
+          tiles(tiles), used(used), done(done) {}
 
-                // if going layer 1->2 then slopes = more
-                if ((thisTile.flags.layer < level->tiles[y][x + 1].flags.layer)
-                        && (level->tiles[y][x + 1].geometry >= slopes))
-                    rightBaseHeight++;
+    void run() {
+        int l = level->header.length;
 
-                // if going layer 2->1, don't draw as much
-                else if (thisTile.flags.layer && !level->tiles[y][x + 1].flags.layer)
-                    rightBaseHeight--;
-            }
+        for (int x = firstX; x < lastX; x++)
+            for (int y = 0; y < l; y++)
+                used[x * l + y] = buildIsometricTile(level, x, y, h, &tiles[x * l + y]);
 
-            // do the height tiles
-            for (int tileY = 2; tileY <= (2 * leftBaseHeight) || tileY < (2 * rightBaseHeight); tileY += 2)
-                for (int tileX = 0; tileX < 4; tileX++) {
-                    // left side
-                    if (tileY <= 2 * leftBaseHeight) {
-                        playfield[terrainLayer][startY + 4 + tileY][startX + tileX]
-                                = stackTile[0][tileX] | terrainPrio;
-                        playfield[terrainLayer][startY + 5 + tileY][startX + tileX]
-                                = stackTile[1][tileX] | terrainPrio;
-                    }
-                    // right side
-                    if (tileY <= 2 * rightBaseHeight) {
-                        playfield[terrainLayer][startY + 4 + tileY][startX + 4 + tileX]
-                                = stackTile[0][tileX + 4] | terrainPrio;
-                        playfield[terrainLayer][startY + 5 + tileY][startX + 4 + tileX]
-                                = stackTile[1][tileX + 4] | terrainPrio;
-                    }
-                }
-            // draw the base tiles
-            if ((leftBaseHeight == z + 1) || (rightBaseHeight == z + 1))
-            for (int tileX = 0; tileX < 4; tileX++) {
-                // left side
-                if (leftBaseHeight == z + 1) {
-                    playfield[terrainLayer][startY + 6 + (2 * z)][startX + tileX]
-                            = bottomTile[0][tileX] | terrainPrio;
-                    playfield[terrainLayer][startY + 7 + (2 * z)][startX + tileX]
-                            = bottomTile[1][tileX] | terrainPrio;
-                }
-                // right side
-                if (rightBaseHeight == z + 1) {
-                    playfield[terrainLayer][startY + 6 + (2 * z)][startX + tileX + 4]
-                            = bottomTile[0][tileX + 4] | terrainPrio;
-                    playfield[terrainLayer][startY + 7 + (2 * z)][startX + tileX + 4]
-                            = bottomTile[1][tileX + 4] | terrainPrio;
-                }
-            }
+        done->release();
+    }
 
-            // now the actual tile itself
-            for (int tileY = 0; tileY < 8; tileY++)
-                for (int tileX = 0; tileX < 8; tileX++) {
-                    int layer, prio;
-
-                    if (tileY < leftEdgeSize && tileX < 4) {
-                        layer = terrainLeftLayer;
-                        prio = terrainLeftPrio;
-                    } else if (tileY < rightEdgeSize) {
-                        layer = terrainRightLayer;
-                        prio = terrainRightPrio;
-                    } else {
-                        layer = terrainLayer;
-                        prio = terrainPrio;
-                    }
-
-                    if (TILE(meta.tiles[tileY][tileX]))
-                        playfield[layer][startY + tileY][startX + tileX]
-                                = meta.tiles[tileY][tileX] | prio;
-
-                    if (TILE(obs.tiles[tileY][tileX]))
-                      playfield[layer ^ 1][startY + startYObs + tileY][startX + tileX]
-                                = obs.tiles[tileY][tileX] | PRI;
+protected:
+    const leveldata_t *level;
+    int h, firstX, lastX;
+    isotile_t *tiles;
+    bool *used;
+    QSemaphore *done;
 
-                }
+};
+
+/*
+  Thread pool used for building isometric maps and rendering the preview in parallel.
+  (this is kept separate from the global thread pool, since saveAllLevels waits on that one
+  to finish everything)
+*/
+Q_GLOBAL_STATIC(QThreadPool, threadPool)
+
+QThreadPool* levelThreadPool() {
+    return threadPool();
+}
+
+/*
+  Same as makeIsometricMap, but builds the metatiles for each 2D tile on several threads at once.
+  The actual drawing still happens in the same back-to-front order as before (since later tiles
+  overwrite earlier ones), so the result is exactly the same as the single-threaded version.
+
+  If numThreads is 0, the number of threads is based on the number of CPU cores.
+*/
+void makeIsometricMapParallel(Playfield &playfield, leveldata_t *level, int numThreads) {
+    int h = startIsometricMap(playfield, level);
+    int l = level->header.length;
+    int w = level->header.width;
+
+    if (numThreads <= 0)
+        numThreads = levelThreadPool()->maxThreadCount();
+    numThreads = qBound(1, numThreads, qMax(w, 1));
+
+    if (numThreads > levelThreadPool()->maxThreadCount())
+        levelThreadPool()->setMaxThreadCount(numThreads);
+
+    std::vector<isotile_t> tiles(w * l);
+    QVector<bool>          used(w * l);
+    QSemaphore done;
+
+    // split the map up into groups of columns, one per thread
+    for (int i = 0; i < numThreads; i++) {
+        levelThreadPool()->start(new IsoTileWorker(level, h,
+                                                 w * i / numThreads, w * (i + 1) / numThreads,
+                                                 tiles.data(), used.data(), &done));
+    }
+    done.acquire(numThreads);
+
+    // render "back to front" - that is, from north to south, west to east
+    for (int x = 0; x < w; x++) {
+        for (int y = 0; y < l; y++) {
+            if (used[x * l + y])
+                drawIsometricTile(playfield, tiles[x * l + y]);
         }
     }
 }
@@ -7,12 +7,14 @@
 #define LEVEL_H
 
 #include "romfile.h"
+#include "playfield.h"
 #include <cstdint>
 
 #include <QThreadPool>
 #include <QList>
 #include <QByteArray>
 #include <QMessageBox>
+#include <QRect>
 
 #define CHUNK_SIZE 2048
 #define BIG_CHUNK_SIZE 26624
@@ -76,6 +78,23 @@ typedef struct {
 
 extern const maptile_t noTile;
 
+/*
+  Statistics about the tiles inside a level's area, kept up to date as tiles are changed
+  (see setTile) so that they never have to be found by going through the whole level.
+*/
+typedef struct {
+    // number of tiles at each height and with each obstacle type
+    uint16_t heights[256];
+    uint16_t obstacles[256];
+    // number of non-empty tiles in each row and column
+    uint16_t rows[MAX_2D_SIZE], cols[MAX_2D_SIZE];
+
+    // the highest tile, number of water hazards, and the area containing non-empty tiles
+    // (which is empty if top > bottom)
+    int      maxHeight, water;
+    int      left, top, right, bottom;
+} levelstats_t;
+
 /*
   Level tile info as it is passed to/from the tile edit window
   (and possibly a "copy/paste tile properties" feature in the future.)
@@ -110,20 +129,39 @@ typedef struct {
 
     // music track number. see kirby.cpp (or stuff.cpp if i ever rename it)
     uint8_t   music;
+
+    // statistics about the tiles (see updateLevelStats and setTile)
+    levelstats_t stats;
 } leveldata_t;
 
 /*
   Functions for loading/saving level data
 */
 leveldata_t*  loadLevel(ROMFile& file, uint num);
+QList<QByteArray>   makeLevelChunks(leveldata_t *level, int *fieldSize = 0);
 QList<QByteArray*>  saveLevel(leveldata_t *level, int *fieldSize = 0);
 uint          saveAllLevels(ROMFile& file, leveldata_t **levels);
 
-size_t        makeClipTable(const leveldata_t *level, uint8_t *buffer);
-void          makeIsometricMap(uint16_t playfield[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH], leveldata_t *level);
+size_t        makeClipTable(const leveldata_t *level, uint8_t *buffer = 0);
+void          makeIsometricMap(Playfield &playfield, leveldata_t *level);
+void          makeIsometricMapParallel(Playfield &playfield, leveldata_t *level, int numThreads = 0);
+// thread pool for splitting up work on a single level (building or rendering its isometric map)
+QThreadPool*  levelThreadPool();
+
+// find the level statistics from scratch (after loading a level or changing its size)
+void          updateLevelStats(leveldata_t *level);
+// change one tile and update the level statistics to match
+// (any changes to the tiles should go through this)
+void          setTile(leveldata_t *level, uint x, uint y, const maptile_t &tile);
 
 uint          levelHeight(const leveldata_t *level);
 bool          waterLevel(const leveldata_t *level);
+// the smallest area containing all of the non-empty tiles
+QRect         levelBounds(const leveldata_t *level);
+// number of tiles with an obstacle type
+uint          obstacleCount(const leveldata_t *level, uint obstacle);
+// a hash of the level's size and tiles (i.e. everything that affects how it looks)
+QByteArray    levelHash(const leveldata_t *level);
 
 /*
  * Worker objects for generating compressed level data
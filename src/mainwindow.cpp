@@ -19,15 +19,21 @@
 #include <QUrl>
 #include <QStandardPaths>
 #include <QEvent>
+#include <QElapsedTimer>
+#include <QThread>
 
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <vector>
 
 #include "romfile.h"
 #include "kirby.h"
 #include "level.h"
 #include "propertieswindow.h"
+#include "previewrenderer.h"
+#include "graphicscache.h"
+#include "graphics.h"
 #include "coursewindow.h"
 #include "version.h"
 
@@ -49,7 +55,10 @@ MainWindow::MainWindow(QWidget *parent) :
 
     levelLabel(new QLabel()),
     scene(new MapScene(this, &currentLevel)),
-    previewWin(new PreviewWindow(this, &currentLevel))
+    previewWin(new PreviewWindow(this, &currentLevel)),
+    budget(new BudgetWidget(this, &currentLevel)),
+    budgetDock(new QDockWidget(tr("Level Size"), this)),
+    browser(new CourseBrowser(this))
 {
     ui->setupUi(this);
 
@@ -59,6 +68,7 @@ MainWindow::MainWindow(QWidget *parent) :
     currentLevel.header.width = 0;
     currentLevel.header.length = 0;
     currentLevel.modifiedRecently = false;
+    updateLevelStats(&currentLevel);
 
     fileName   = settings->value("MainWindow/fileName", "").toString();
 
@@ -68,6 +78,13 @@ MainWindow::MainWindow(QWidget *parent) :
     // remove margins around map view and other stuff
     this->centralWidget()->layout()->setContentsMargins(0,0,0,0);
 
+    // set up the level size panel
+    budgetDock->setObjectName("budgetDock");
+    budgetDock->setWidget(budget);
+    this->addDockWidget(Qt::RightDockWidgetArea, budgetDock);
+    ui->menuLevel->insertAction(ui->action_Select_Course, budgetDock->toggleViewAction());
+    ui->menuLevel->insertSeparator(ui->action_Select_Course);
+
     setupSignals();
     setupActions();
     getSettings();
@@ -135,6 +152,8 @@ void MainWindow::setupSignals() {
 
     QObject::connect(scene, SIGNAL(edited()),
                      previewWin, SLOT(refresh()));
+    QObject::connect(scene, SIGNAL(edited()),
+                     budget, SLOT(refresh()));
     QObject::connect(scene, SIGNAL(edited()),
                      this, SLOT(setUnsaved()));
     QObject::connect(scene, SIGNAL(edited()),
@@ -158,13 +177,26 @@ void MainWindow::setupSignals() {
     QObject::connect(ui->action_Level_Properties, SIGNAL(triggered()),
                      this, SLOT(levelProperties()));
 
+    QObject::connect(ui->action_Zoom_In, SIGNAL(triggered()),
+                     scene, SLOT(zoomIn()));
+    QObject::connect(ui->action_Zoom_Out, SIGNAL(triggered()),
+                     scene, SLOT(zoomOut()));
+    QObject::connect(ui->action_Actual_Size, SIGNAL(triggered()),
+                     scene, SLOT(resetZoom()));
+
     QObject::connect(ui->action_Show_Preview, SIGNAL(triggered()),
                      previewWin, SLOT(show()));
     QObject::connect(ui->action_Center_Preview, SIGNAL(toggled(bool)),
                      previewWin, SLOT(enableCenter(bool)));
+    QObject::connect(ui->action_Night_Palette, SIGNAL(toggled(bool)),
+                     previewWin, SLOT(enableNight(bool)));
+    QObject::connect(ui->action_Animate_Preview, SIGNAL(toggled(bool)),
+                     previewWin, SLOT(enableAnimation(bool)));
 
     QObject::connect(ui->action_Select_Course, SIGNAL(triggered()),
                      this, SLOT(selectCourse()));
+    QObject::connect(ui->action_Browse_Courses, SIGNAL(triggered()),
+                     this, SLOT(browseCourses()));
     QObject::connect(ui->action_Previous_Level, SIGNAL(triggered()),
                      this, SLOT(prevLevel()));
     QObject::connect(ui->action_Next_Level, SIGNAL(triggered()),
@@ -184,6 +216,8 @@ void MainWindow::setupSignals() {
     // debug menu
     QObject::connect(ui->action_Dump_Level, SIGNAL(triggered()),
                      this, SLOT(dumpLevel()));
+    QObject::connect(ui->action_Benchmark_Map, SIGNAL(triggered()),
+                     this, SLOT(benchmarkMap()));
 
     // other window-related stuff
     // refresh the preview window when the level is edited by double-clicking
@@ -196,6 +230,11 @@ void MainWindow::setupSignals() {
     // center the 3D view when mousing over the 2D view
     QObject::connect(scene, SIGNAL(mouseOverTile(int,int)),
                      previewWin, SLOT(centerOn(int,int)));
+    // and the other way around, show the tile under the mouse in the 3D view on the 2D view
+    QObject::connect(previewWin, SIGNAL(tileHovered(int,int)),
+                     scene, SLOT(hoverTile(int,int)));
+    QObject::connect(previewWin, SIGNAL(tileClicked(int,int)),
+                     this, SLOT(selectPreviewTile(int,int)));
 }
 
 void MainWindow::setupActions() {
@@ -232,8 +271,16 @@ void MainWindow::getSettings() {
         this      ->showMaximized();
     if (settings->contains("PreviewWindow/geometry"))
         previewWin->setGeometry(settings->value("PreviewWindow/geometry").toRect());
+    if (settings->contains("MainWindow/state"))
+        this      ->restoreState(settings->value("MainWindow/state").toByteArray());
 
     ui->action_Center_Preview->setChecked(settings->value("PreviewWindow/center", true).toBool());
+    ui->action_Night_Palette ->setChecked(settings->value("PreviewWindow/night", false).toBool());
+    ui->action_Animate_Preview->setChecked(settings->value("PreviewWindow/animate", false).toBool());
+    // (in MB)
+    previewWin->setCacheSize(settings->value("PreviewWindow/cacheSize", 64).toUInt() * 1024 * 1024);
+    browser->setDiskCacheSize(settings->value("CourseBrowser/diskCacheSize", 32).toLongLong() * 1024 * 1024);
+    scene->setUndoMemory(settings->value("MainWindow/undoMemory", 16).toUInt() * 1024 * 1024);
 
     // display friendly message
     status(tr("Welcome to the untitled Kirby's Dream Course editor, version %1.")
@@ -250,9 +297,12 @@ void MainWindow::saveSettings() {
     settings->setValue("MainWindow/maximized", this->isMaximized());
     if (!this->isMaximized())
         settings->setValue("MainWindow/geometry", this->geometry());
+    settings->setValue("MainWindow/state", this->saveState());
 
     settings->setValue("PreviewWindow/geometry", previewWin->geometry());
     settings->setValue("PreviewWindow/center", ui->action_Center_Preview->isChecked());
+    settings->setValue("PreviewWindow/night", ui->action_Night_Palette->isChecked());
+    settings->setValue("PreviewWindow/animate", ui->action_Animate_Preview->isChecked());
 }
 
 /*
@@ -272,7 +322,9 @@ void MainWindow::setUnsaved() {
 void MainWindow::setOpenFileActions(bool val) {
     ui->action_Dump_Header        ->setEnabled(val);
     ui->action_Dump_Level         ->setEnabled(val);
+    ui->action_Benchmark_Map      ->setEnabled(val);
     ui->action_Select_Course      ->setEnabled(val);
+    ui->action_Browse_Courses     ->setEnabled(val);
     ui->action_Show_Preview       ->setEnabled(val);
     ui->action_Save_Level_to_Image->setEnabled(val);
     setEditActions(val);
@@ -369,6 +421,9 @@ void MainWindow::openFile() {
 
             fileOpen = true;
 
+            // don't let thumbnails of old levels (or other ROMs) pile up forever
+            browser->pruneDiskCache();
+
             ROMFile::game_e game = rom.getGame();
 
             for (int i = 0; i < numLevels[game]; i++) {
@@ -409,6 +464,9 @@ void MainWindow::openFile() {
                 ptr = rom.readInt16(waterTable[0][ver] + 2 * i);
                 waterPalette[i] = (ptr - waterBase[0][ver]) / WATER_PALETTE_SIZE;
             }
+            // and the actual colors for the preview
+            readPalettes(rom, &palettes);
+
             // get background number by comparing palette pointers
             // (since they're shorter and require no number mangling)
             // these are only for courses 0-7, and then repeat
@@ -618,11 +676,14 @@ int MainWindow::closeFile() {
     currentLevel.header.length = 0;
     currentLevel.header.width  = 0;
     currentLevel.modifiedRecently = false;
+    updateLevelStats(&currentLevel);
 
     scene->cancelSelection();
     scene->refresh(false);
-    scene->clearStack();
+    scene->clearAllStacks();
+    previewWin->setPalette(NULL, 0, 0);
     previewWin->refresh();
+    budget->refresh();
     previewWin->hide();
 
     levelLabel->setText("");
@@ -705,6 +766,7 @@ void MainWindow::loadLevelFromFile() {
                 file.read((char*)&(lev->tiles[y][x].flags), 1);
             }
         }
+        updateLevelStats(lev);
 
         // set music data
         lev->music = music;
@@ -712,6 +774,8 @@ void MainWindow::loadLevelFromFile() {
         // mark level as modified
         lev->modified = true;
         lev->modifiedRecently = false;
+        // (and forget the old level's undo history)
+        scene->clearStack(level);
         setLevel(level);
         unsaved = true;
     }
@@ -832,6 +896,7 @@ void MainWindow::loadCourseFromFile() {
 
             *lev = leveldata_t();
             lev->header = tempHeader;
+            scene->clearStack(courseStart + i);
 
             // load tile data
             for (int y = 0; y < lev->header.length; y++) {
@@ -842,6 +907,7 @@ void MainWindow::loadCourseFromFile() {
                     file.read((char*)&(lev->tiles[y][x].flags), 1);
                 }
             }
+            updateLevelStats(lev);
 
             // set music data
             lev->music = info.music[i];
@@ -946,7 +1012,9 @@ void MainWindow::levelProperties() {
 
     // update 2D and 3D displays
     scene->refresh(false);
+    previewWin->setPalette(&palettes, palette[course], waterPalette[course]);
     previewWin->refresh();
+    budget->refresh();
 }
 
 void MainWindow::selectCourse() {
@@ -957,6 +1025,23 @@ void MainWindow::selectCourse() {
         setLevel(newLevel);
 }
 
+void MainWindow::browseCourses() {
+    ROMFile::game_e game = rom.getGame();
+
+    int newLevel = browser->select(level, levels, game);
+    if (newLevel != level)
+        setLevel(newLevel);
+}
+
+void MainWindow::selectPreviewTile(int x, int y) {
+    scene->selectTile(x, y);
+
+    // scroll the 2D view to the tile too
+    QRect rect = scene->tileRect(x, y);
+    ui->scrollArea->ensureVisible(rect.center().x(), rect.center().y(),
+                                  rect.width(), rect.height());
+}
+
 void MainWindow::prevLevel() {
     if (level) setLevel(level - 1);
 }
@@ -997,7 +1082,13 @@ void MainWindow::setLevel(int level) {
         return;
 
     // save changes to the level?
-    if (checkSaveLevel() == QMessageBox::Cancel) return;
+    QMessageBox::StandardButton button = checkSaveLevel();
+    if (button == QMessageBox::Cancel) return;
+
+    // if the changes were thrown away, so is their undo history
+    // (otherwise each level keeps its own undo history)
+    if (button == QMessageBox::No && currentLevel.modifiedRecently)
+        scene->clearStack();
 
     ROMFile::game_e game = rom.getGame();
 
@@ -1010,10 +1101,21 @@ void MainWindow::setLevel(int level) {
     // set up the graphics view
     scene->cancelSelection();
     scene->refresh(false);
-    scene->clearStack();
-    setUndoRedoActions(false);
+    scene->setUndoLevel(level);
+    setUndoRedoActions(true);
 
+    previewWin->setPalette(&palettes, palette[level / 8], waterPalette[level / 8]);
     previewWin->refresh();
+    budget->refresh();
+
+    // get the levels the user is most likely to switch to next ready in the background
+    // (next/previous level, then next/previous course)
+    QList<const leveldata_t*> nearby;
+    for (int next: {level + 1, level - 1, level + 8, level - 8}) {
+        if (next >= 0 && next < numLevels[game])
+            nearby.append(levels[next]);
+    }
+    previewWin->prefetch(nearby);
 
     // display the level name in the toolbar label
     levelLabel->setText(tr(" Level %1 - %2 (%3)")
@@ -1134,12 +1236,12 @@ void MainWindow::dumpLevel() {
     fprintf(txt, "Index\t\t\tx-\tx+\tprio\tzref\n");
 
     // generate and print chunk 10 for current level
-    uint8_t clipTable[2048];
+    std::vector<uint8_t> clipTable(makeClipTable(&currentLevel));
     uint8_t count;
     uint16_t ptr;
     clip_t clipTest;
 
-    makeClipTable(&currentLevel, clipTable);
+    makeClipTable(&currentLevel, clipTable.data());
 
     for (int i = l + w - 1; i >= 0; i--) {
         fprintf(txt, "%d\t", i);
@@ -1181,3 +1283,82 @@ void MainWindow::dumpLevel() {
 
     QDesktopServices::openUrl(QUrl("currentlevel.txt"));
 }
+
+/*
+  Times building the current level's 3D tile map, both single-threaded and with
+  an increasing number of threads, and makes sure the results are all the same.
+*/
+void MainWindow::benchmarkMap() {
+    const int runs = 20;
+    Playfield serial, parallel;
+    QElapsedTimer timer;
+
+    FILE *txt = fopen("benchmark.txt", "w");
+    if (!txt) {
+        QMessageBox::warning(this, tr("Benchmark"),
+                             tr("Unable to open benchmark.txt for writing."),
+                             QMessageBox::Ok);
+        status(tr("Benchmark not run."));
+        return;
+    }
+
+    fprintf(txt, "Level 0x%02X (course %d hole %d): %d w x %d l x %d h\n", level, (level / 8) + 1, (level % 8) + 1,
+            currentLevel.header.width, currentLevel.header.length, levelHeight(&currentLevel));
+    fprintf(txt, "Average of %d runs each.\n\n", runs);
+
+    timer.start();
+    for (int i = 0; i < runs; i++)
+        makeIsometricMap(serial, &currentLevel);
+    double serialTime = timer.nsecsElapsed() / (runs * 1000000.0);
+
+    fprintf(txt, "Single-threaded:\t%8.3f ms\n", serialTime);
+
+    int maxThreads = QThread::idealThreadCount();
+    for (int threads = 1; ; threads *= 2) {
+        threads = qMin(threads, maxThreads);
+
+        timer.restart();
+        for (int i = 0; i < runs; i++)
+            makeIsometricMapParallel(parallel, &currentLevel, threads);
+        double time = timer.nsecsElapsed() / (runs * 1000000.0);
+
+        fprintf(txt, "%3d thread(s):\t\t%8.3f ms\t(%.2fx)%s\n", threads, time, serialTime / time,
+                parallel == serial ? "" : "\tMISMATCH");
+
+        if (threads == maxThreads) break;
+    }
+
+    // next, render the preview using the same map
+    PreviewRenderer renderer;
+    QImage serialImage, parallelImage;
+
+    fprintf(txt, "\nPreview rendering (%d x %d pixels):\n\n",
+            serial.width() * ISO_TILE_SIZE, serial.height() * ISO_TILE_SIZE);
+
+    timer.restart();
+    for (int i = 0; i < runs; i++)
+        serialImage = renderer.render(serial, &currentLevel, true, 1);
+    serialTime = timer.nsecsElapsed() / (runs * 1000000.0);
+
+    fprintf(txt, "Single-threaded:\t%8.3f ms\n", serialTime);
+
+    for (int threads = 2; maxThreads > 1; threads *= 2) {
+        threads = qMin(threads, maxThreads);
+
+        timer.restart();
+        for (int i = 0; i < runs; i++)
+            parallelImage = renderer.render(serial, &currentLevel, true, threads);
+        double time = timer.nsecsElapsed() / (runs * 1000000.0);
+
+        fprintf(txt, "%3d thread(s):\t\t%8.3f ms\t(%.2fx)%s\n", threads, time, serialTime / time,
+                parallelImage == serialImage ? "" : "\tMISMATCH");
+
+        if (threads == maxThreads) break;
+    }
+
+    fprintf(txt, "\nCached graphics:\t%8.1f KB\n", GraphicsCache::memoryUsage() / 1024.0);
+
+    fclose(txt);
+
+    QDesktopServices::openUrl(QUrl("benchmark.txt"));
+}
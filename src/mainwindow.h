@@ -9,12 +9,15 @@
 #include <QtWidgets/QMainWindow>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QLabel>
+#include <QtWidgets/QDockWidget>
 #include <QSettings>
 
 #include "romfile.h"
 #include "mapscene.h"
 #include "level.h"
 #include "previewwindow.h"
+#include "budgetwidget.h"
+#include "coursebrowser.h"
 
 namespace Ui {
 class MainWindow;
@@ -48,6 +51,7 @@ protected slots:
     void levelProperties();
 
     void selectCourse();
+    void browseCourses();
     void prevLevel();
     void nextLevel();
     void prevCourse();
@@ -60,8 +64,12 @@ protected slots:
     // display text on the statusbar
     void status(const QString &msg);
 
+    // select a tile clicked in the preview window
+    void selectPreviewTile(int x, int y);
+
     // debug menu crap
     void dumpLevel();
+    void benchmarkMap();
     
     // toolbar updates
     void setOpenFileActions(bool val);
@@ -93,11 +101,18 @@ private:
     int    background[8];
     int    palette[28];
     int    waterPalette[28];
+    // the colors of each palette
+    palettes_t palettes;
 
     // renderin stuff
     MapScene *scene;
     // the preview window
     PreviewWindow *previewWin;
+    // the level size/budget panel
+    BudgetWidget *budget;
+    QDockWidget  *budgetDock;
+    // thumbnails of every level
+    CourseBrowser *browser;
 
     // various funcs
     void setupSignals();
@@ -3,16 +3,32 @@
     See COPYING.txt for details.
 */
 
+#include <cstring>
+
 #include "mapchange.h"
 #include "level.h"
 
-MapChange::MapChange(leveldata_t *currLevel, uint selX, uint selY, uint selW, uint selL, QUndoCommand *parent) :
+size_t MapChange::usedMemory = 0;
+
+static inline bool sameTile(const maptile_t &a, const maptile_t &b) {
+    return !memcmp(&a, &b, sizeof(maptile_t));
+}
+
+// position of a changed cell, for keeping them in order by row
+static inline int cellPos(const cellchange_t &cell) {
+    return cell.y * MAX_2D_SIZE + cell.x;
+}
+
+MapChange::MapChange(leveldata_t *currLevel, uint selX, uint selY, uint selW, uint selL,
+                     int mergeID, QUndoCommand *parent) :
     QUndoCommand(parent),
     level(currLevel),
-    x(selX), y(selY), w(selW), l(selL),
+    x(selX), y(selY),
+    // (don't go past the edge of the map)
+    w(qMin(selW, MAX_2D_SIZE - qMin(selX, (uint)MAX_2D_SIZE))),
+    l(qMin(selL, MAX_2D_SIZE - qMin(selY, (uint)MAX_2D_SIZE))),
     before(new maptile_t[l * w]),
-    after (new maptile_t[l * w]),
-    first(true)
+    mergeID(mergeID)
 {
     // when instantiated, save the region's pre-edit state
     if (level) {
@@ -22,42 +38,113 @@ MapChange::MapChange(leveldata_t *currLevel, uint selX, uint selY, uint selW, ui
 
         this->setText("edit");
     }
+
+    usedMemory += memoryUsage();
 }
 
 MapChange::~MapChange() {
+    usedMemory -= memoryUsage();
+
     delete[] before;
-    delete[] after;
+}
+
+size_t MapChange::memoryUsage() const {
+    return sizeof(MapChange) + (before ? l * w * sizeof(maptile_t) : 0)
+            + changes.capacity() * sizeof(cellchange_t);
 }
 
 void MapChange::undo() {
     // restore to the region's pre-edit state
     if (level) {
-        for (uint row = 0; row < this->l; row++)
-            for (uint col = 0; col < this->w; col++)
-                this->level->tiles[y + row][x + col] = before[(row * w) + col];
+        for (const cellchange_t &cell: changes)
+            setTile(level, cell.x, cell.y, cell.before);
     }
 }
 
 void MapChange::redo() {
-    // if being pushed, save the region's post-edit state
-    // otherwise restore it
-    if (level) {
-        for (uint row = 0; row < this->l; row++)
-            for (uint col = 0; col < this->w; col++) {
-                if (first) after[(row * w) + col] = this->level->tiles[y + row][x + col];
-                else       this->level->tiles[y + row][x + col] = after[(row * w) + col];
+    if (!level) return;
+
+    if (before) {
+        // if being pushed, find which cells were actually changed,
+        // and throw away the rest of the pre-edit state
+        usedMemory -= memoryUsage();
+
+        for (uint row = 0; row < l; row++)
+            for (uint col = 0; col < w; col++) {
+                const maptile_t &after = level->tiles[y + row][x + col];
+
+                if (!sameTile(before[(row * w) + col], after)) {
+                    cellchange_t cell = {(uint8_t)(x + col), (uint8_t)(y + row),
+                                         before[(row * w) + col], after};
+                    changes.append(cell);
+                }
             }
 
-        if (first) {
-            level->modified = true;
-            level->modifiedRecently = true;
+        changes.squeeze();
+        delete[] before;
+        before = NULL;
+
+        usedMemory += memoryUsage();
+
+        level->modified = true;
+        level->modifiedRecently = true;
+
+    } else {
+        // otherwise restore the region's post-edit state
+        for (const cellchange_t &cell: changes)
+            setTile(level, cell.x, cell.y, cell.after);
+    }
+}
+
+/*
+  Combines an edit with the one right after it, if they're the same kind of edit to the
+  same tiles (e.g. raising and lowering the same selection over and over.)
+*/
+bool MapChange::mergeWith(const QUndoCommand *other) {
+    const MapChange *next = static_cast<const MapChange*>(other);
+
+    if (next->id() != mergeID || next->level != level || before || next->before
+            || next->x != x || next->y != y || next->w != w || next->l != l)
+        return false;
+
+    usedMemory -= memoryUsage();
+
+    // both lists are in the same order, so go through them together
+    QVector<cellchange_t> merged;
+    int i = 0, j = 0;
+    while (i < changes.size() || j < next->changes.size()) {
+        if (j >= next->changes.size()
+                || (i < changes.size() && cellPos(changes[i]) < cellPos(next->changes[j]))) {
+            merged.append(changes[i++]);
+
+        } else if (i >= changes.size() || cellPos(next->changes[j]) < cellPos(changes[i])) {
+            merged.append(next->changes[j++]);
+
+        } else {
+            // changed by both - keep the first "before" and the last "after"
+            // (unless the cell ended up back the way it was)
+            cellchange_t cell = changes[i++];
+            cell.after = next->changes[j++].after;
+            if (!sameTile(cell.before, cell.after))
+                merged.append(cell);
         }
     }
 
-    first = false;
+    merged.squeeze();
+    changes = merged;
+    usedMemory += memoryUsage();
+
+    if (next->action != action)
+        setText(mergeID == heightChange ? "change height" : "edit");
+
+    // if everything ended up back the way it was, there's nothing left to undo
+    setObsolete(changes.isEmpty());
+
+    return true;
 }
 
 void MapChange::setText(const QString &text) {
+    action = text;
     QUndoCommand::setText(QString(text)
                           .append(" from (%1, %2) to (%3, %4)")
                           .arg(x).arg(y).arg(x + w - 1).arg(y + l - 1));
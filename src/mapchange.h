@@ -6,15 +6,38 @@
 #ifndef MAPCHANGE_H
 #define MAPCHANGE_H
 
+#include <cstddef>
 #include <QUndoCommand>
+#include <QVector>
 
 #include "level.h"
 
+/*
+  One cell of the 2D map changed by an edit.
+*/
+typedef struct {
+    uint8_t   x, y;
+    maptile_t before, after;
+} cellchange_t;
+
+/*
+  An undoable edit to a rectangle of the 2D map.
+  The whole rectangle is copied when the edit starts, but once it's done only the cells
+  which actually changed are kept.
+*/
 class MapChange : public QUndoCommand
 {
 public:
+    // kinds of edits which are merged together when they're done to the same tiles
+    // one after the other (see mergeWith)
+    enum {
+        noMerge = -1,
+        heightChange = 1
+    };
+
     explicit MapChange(leveldata_t *currLevel,
                        uint x, uint y, uint w, uint l,
+                       int mergeID = noMerge,
                        QUndoCommand *parent = 0);
     ~MapChange();
 
@@ -22,11 +45,24 @@ public:
     void redo();
     void setText(const QString &text);
 
+    int  id() const { return mergeID; }
+    bool mergeWith(const QUndoCommand *other);
+
+    // approximate amount of memory used by this edit, and by all of them together
+    size_t memoryUsage() const;
+    static size_t totalMemoryUsage() { return usedMemory; }
+
 private:
     leveldata_t *level;
     uint x, y, w, l;
-    maptile_t *before, *after;
-    bool first;
+    // the whole rectangle from before the edit (only until the edit is done)
+    maptile_t *before;
+    // the cells which were changed, in order by row
+    QVector<cellchange_t> changes;
+    int mergeID;
+    QString action;
+
+    static size_t usedMemory;
 };
 
 #endif // MAPCHANGE_H
@@ -5,6 +5,7 @@
 
 #include <QPixmap>
 #include <QPainter>
+#include <QRegion>
 #include <algorithm>
 #include <stdexcept>
 #include <cstdlib>
@@ -16,9 +17,26 @@
 #include "mapchange.h"
 #include "tileeditwindow.h"
 #include "graphics.h"
+#include "graphicscache.h"
+#include "obstaclesprites.h"
 
 #define MAP_TEXT_PAD_H 2
 #define MAP_TEXT_PAD_V 1
+// size of the tile atlas (in tiles)
+#define MAP_ATLAS_COLUMNS 32
+#define MAP_ATLAS_ROWS    16
+// each tile gets enough space in the atlas for obstacles up to two tiles tall
+#define MAP_SLOT_HEIGHT   (2 * TILE_SIZE)
+
+// zoom limits, and how much each step zooms in or out
+#define MAP_MIN_ZOOM  0.0625
+#define MAP_MAX_ZOOM  2.0
+#define MAP_ZOOM_STEP 1.25
+// below this zoom level, the map is drawn using simple glyphs instead of the actual
+// graphics (and without any text)
+#define MAP_DETAIL_ZOOM 0.5
+// size of each tile's glyph in the largest overview image
+#define MAP_GLYPH_SIZE 16
 
 const QFont MapScene::infoFont("Consolas", 8);
 const QFontMetrics MapScene::infoFontMetrics(MapScene::infoFont);
@@ -31,6 +49,25 @@ const QColor MapScene::selectionBorder(255, 192, 192, 255);
 
 const QColor MapScene::layerColor(0, 192, 224, 192);
 
+// color of the center of each obstacle's glyph, by sprite sheet
+static const QRgb glyphColors[NUM_SPRITE_SHEETS] = {
+    0,                   // none
+    qRgb(255, 160,   0), // bounce
+    qRgb(160, 160, 160), // bumpers
+    qRgb(224, 224,  64), // conveyor
+    qRgb( 64,  64, 255), // dedede
+    qRgb(224,  32,  32), // enemies
+    qRgb(128,   0, 128), // gordo
+    qRgb(255, 128, 192), // kirby
+    qRgb( 64, 224, 224), // movers
+    qRgb(160,  96, 224), // rotate
+    qRgb(255, 255, 255), // switches
+    qRgb(160, 120,  64), // traps
+    qRgb(255,  64, 255), // warps
+    qRgb( 32,  96, 255), // water
+    qRgb(  0,   0,   0)  // unknown
+};
+
 /*
   Overridden constructor which inits some scene info
  */
@@ -40,24 +77,20 @@ MapScene::MapScene(QWidget *parent, leveldata_t *currentLevel)
       tileX(-1), tileY(-1),
       selLength(0), selWidth(0), selecting(false),
       copyWidth(0), copyLength(0),
-      stack(this),
-      level(currentLevel)
+      stack(NULL), undoLevel(-1),
+      undoMemory(MAP_UNDO_MEMORY),
+      level(currentLevel),
+      zoom(1.0),
+      atlasHalfDirty(true),
+      overviewDirty(true)
 {
-    bounce.load  (":images/bounce.png");
-    bumpers.load (":images/bumpers.png");
-    conveyor.load(":images/conveyor.png");
-    dedede.load  (":images/dedede.png");
-    enemies.load (":images/enemies.png");
-    gordo.load   (":images/gordo.png");
-    kirby.load   (":images/kirby.png");
-    movers.load  (":images/movers.png");
-    rotate.load  (":images/rotate.png");
-    tiles.load   (":images/terrain.png");
-    traps.load   (":images/traps.png");
-    warps.load   (":images/warps.png");
-    water.load   (":images/water.png");
-    switches.load(":images/switches.png");
-    unknown.load (":images/unknown.png");
+    tiles = GraphicsCache::pixmap(":images/terrain.png");
+    for (int i = 0; i < NUM_SPRITE_SHEETS; i++) {
+        if (spriteFiles2D[i])
+            sprites[i] = GraphicsCache::pixmap(spriteFiles2D[i]);
+    }
+
+    setUndoLevel(-1);
 
     this->setMouseTracking(true);
     this->setFocusPolicy(Qt::WheelFocus);
@@ -78,7 +111,7 @@ void MapScene::editTiles() {
     // send the level and selection info to a new tile edit window instance
     TileEditWindow win;
     if (win.startEdit(level, QRect(selX, selY, selWidth, selLength)))
-        stack.push(edit);
+        pushChange(edit);
     else delete edit;
 
     // redraw the map scene with the new properties
@@ -94,10 +127,112 @@ void MapScene::refresh(bool keepMouse) {
     {
         tileX = tileY = -1;
     }
-    setMinimumSize(level->header.width * TILE_SIZE + 1, level->header.length * TILE_SIZE + 1);
+    overviewDirty = true;
+    resizeMap();
+}
+
+/*
+  Resize the scene to fit the level at the current zoom level, and redraw all of it
+*/
+void MapScene::resizeMap() {
+    setMinimumSize(ceil(level->header.width * TILE_SIZE * zoom) + 1,
+                   ceil(level->header.length * TILE_SIZE * zoom) + 1);
     setMaximumSize(this->minimumSize());
     updateGeometry();
     update();
+
+    // (everything is being redrawn, including the hover info and selection)
+    shownHover = hoverRect();
+    shownSelection = selectionRect();
+}
+
+/*
+  Get the area covered by the hover info (or an empty rect if there isn't any)
+*/
+QRect MapScene::hoverRect() const {
+    if (tileX < level->header.width && tileY < level->header.length
+           && tileX >= 0 && tileY >= 0)
+        return QRect(tileX * TILE_SIZE, tileY * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+
+    return QRect();
+}
+
+/*
+  Get the area covered by the selection (or an empty rect if there isn't one)
+*/
+QRect MapScene::selectionRect() const {
+    if (selWidth == 0 || selLength == 0)
+        return QRect();
+
+    // account for selections in either negative direction
+    int selLeft = qMin(selX, selX + selWidth + 1);
+    int selTop  = qMin(selY, selY + selLength + 1);
+    return QRect(selLeft * TILE_SIZE, selTop * TILE_SIZE, abs(selWidth) * TILE_SIZE, abs(selLength) * TILE_SIZE);
+}
+
+/*
+  Redraw only the parts of the map where the hover info or selection has changed
+*/
+void MapScene::updateOverlays() {
+    QRect hover = hoverRect();
+    QRect selection = selectionRect();
+
+    if (hover != shownHover) {
+        update(toWidget(shownHover));
+        update(toWidget(hover));
+        shownHover = hover;
+    }
+
+    if (selection != shownSelection) {
+        // only the cells which were added to or removed from the selection
+        QRegion changed = QRegion(shownSelection) ^ QRegion(selection);
+        for (const QRect &rect: changed)
+            update(toWidget(rect));
+        shownSelection = selection;
+    }
+}
+
+/*
+  Convert between widget coordinates and (unzoomed) map coordinates
+*/
+QRect MapScene::toMap(const QRect &rect) const {
+    return QRectF(rect.x() / zoom, rect.y() / zoom,
+                  rect.width() / zoom, rect.height() / zoom).toAlignedRect();
+}
+
+QRect MapScene::toWidget(const QRect &rect) const {
+    if (rect.isEmpty())
+        return rect;
+
+    // (plus an extra pixel around the edges, in case of smoothing)
+    return QRectF(rect.x() * zoom, rect.y() * zoom,
+                  rect.width() * zoom, rect.height() * zoom).toAlignedRect().adjusted(-1, -1, 1, 1);
+}
+
+/*
+  Zoom the map in or out
+*/
+void MapScene::setZoom(double zoom) {
+    zoom = qBound(MAP_MIN_ZOOM, zoom, MAP_MAX_ZOOM);
+    if (qFuzzyCompare(zoom, this->zoom))
+        return;
+
+    this->zoom = zoom;
+    resizeMap();
+
+    emit statusMessage(QString("Zoom: %1%").arg(qRound(zoom * 100)));
+}
+
+void MapScene::zoomIn() {
+    setZoom(zoom * MAP_ZOOM_STEP);
+}
+
+void MapScene::zoomOut() {
+    setZoom(zoom / MAP_ZOOM_STEP);
+}
+
+void MapScene::resetZoom() {
+    setZoom(1.0);
 }
 
 /*
@@ -115,7 +250,7 @@ void MapScene::mousePressEvent(QMouseEvent *event) {
     } else if (event->buttons() & Qt::RightButton) {
         cancelSelection();
     }
-    update();
+    updateOverlays();
 }
 
 /*
@@ -126,7 +261,7 @@ void MapScene::mouseDoubleClickEvent(QMouseEvent *event) {
     emit doubleClicked();
 
     event->accept();
-    update();
+    updateOverlays();
 }
 
 /*
@@ -148,7 +283,7 @@ void MapScene::mouseReleaseEvent(QMouseEvent *event) {
         }
 
         event->accept();
-        update();
+        updateOverlays();
     }
 }
 
@@ -171,6 +306,13 @@ void MapScene::mouseMoveEvent(QMouseEvent *event) {
  */
 void MapScene::wheelEvent(QWheelEvent *event)
 {
+    // ctrl+wheel: zoom in/out (by one step per notch of the wheel)
+    if (event->modifiers() & Qt::ControlModifier) {
+        setZoom(zoom * pow(MAP_ZOOM_STEP, event->delta() / 120.0));
+        event->accept();
+        return;
+    }
+
     // TODO: enable/disable this with a setting?
     if (tileX >= selX && tileX < (selX + selWidth)
        && tileY >= selY && tileY < (selY + selLength)
@@ -197,21 +339,21 @@ void MapScene::wheelEvent(QWheelEvent *event)
  *Undo/redo functions
  */
 bool MapScene::canUndo() const {
-    return stack.canUndo();
+    return stack->canUndo();
 }
 
 bool MapScene::canRedo() const {
-    return stack.canRedo();
+    return stack->canRedo();
 }
 
 bool MapScene::isClean() const {
-    return stack.isClean();
+    return stack->isClean();
 }
 
 void MapScene::undo() {
-    if (stack.canUndo()) {
-        emit statusMessage(QString("Undoing ").append(stack.undoText()));
-        stack.undo();
+    if (stack->canUndo()) {
+        emit statusMessage(QString("Undoing ").append(stack->undoText()));
+        stack->undo();
         emit edited();
 
         level->modified = true;
@@ -220,9 +362,9 @@ void MapScene::undo() {
 }
 
 void MapScene::redo() {
-    if (stack.canRedo()) {
-        emit statusMessage(QString("Redoing ").append(stack.redoText()));
-        stack.redo();
+    if (stack->canRedo()) {
+        emit statusMessage(QString("Redoing ").append(stack->redoText()));
+        stack->redo();
         emit edited();
 
         level->modified = true;
@@ -231,11 +373,80 @@ void MapScene::redo() {
 }
 
 void MapScene::setClean() {
-    stack.setClean();
+    stack->setClean();
 }
 
+/*
+  Forget the undo history of the current level (e.g. when its changes are thrown away)
+*/
 void MapScene::clearStack() {
-    stack.clear();
+    stack->clear();
+}
+
+/*
+  Forget the undo history of another level (e.g. when it's replaced with a level from a file)
+*/
+void MapScene::clearStack(int levelNum) {
+    if (levelNum == undoLevel) {
+        stack->clear();
+    } else if (stacks.contains(levelNum)) {
+        usedStacks.removeOne(levelNum);
+        delete stacks.take(levelNum);
+    }
+}
+
+/*
+  Forget the undo history of every level (e.g. when the ROM is closed)
+*/
+void MapScene::clearAllStacks() {
+    for (int levelNum: stacks.keys())
+        clearStack(levelNum);
+}
+
+/*
+  Switch to the undo history of a different level.
+  Each level keeps its own history for as long as it fits in the memory limit,
+  so switching back to a level lets the changes made to it before be undone.
+*/
+void MapScene::setUndoLevel(int levelNum) {
+    if (stack && levelNum == undoLevel)
+        return;
+
+    if (stack)
+        usedStacks.append(undoLevel);
+    usedStacks.removeOne(levelNum);
+
+    undoLevel = levelNum;
+    stack = stacks.value(levelNum, NULL);
+    if (!stack) {
+        stack = new QUndoStack(this);
+        stacks.insert(levelNum, stack);
+    }
+}
+
+/*
+  Set how much memory the undo history of every level together can use
+*/
+void MapScene::setUndoMemory(size_t bytes) {
+    undoMemory = bytes;
+    trimStacks();
+}
+
+/*
+  Add an edit to the current level's undo history
+*/
+void MapScene::pushChange(MapChange *change) {
+    stack->push(change);
+    trimStacks();
+}
+
+/*
+  Throw away the history of the least recently edited levels until everything fits in the
+  memory limit. (The current level's history is always kept.)
+*/
+void MapScene::trimStacks() {
+    while (MapChange::totalMemoryUsage() > undoMemory && !usedStacks.isEmpty())
+        delete stacks.take(usedStacks.takeFirst());
 }
 
 /*
@@ -264,7 +475,7 @@ void MapScene::copyTiles(bool cut = false) {
         for (int j = 0; j < selWidth; j++) {
             copyBuffer[i][j] = level->tiles[selY + i][selX + j];
             if (cut)
-                level->tiles[selY + i][selX + j] = noTile;
+                setTile(level, selX + j, selY + i, noTile);
         }
     }
 
@@ -272,7 +483,7 @@ void MapScene::copyTiles(bool cut = false) {
     copyLength = selLength;
 
     if (cut) {
-        stack.push(edit);
+        pushChange(edit);
         emit edited();
     }
 
@@ -294,11 +505,11 @@ void MapScene::paste() {
     // otherwise, move stuff into the level from the buffer
     for (uint i = 0; i < copyLength && selY + i < MAX_2D_SIZE; i++) {
         for (uint j = 0; j < copyWidth && selX + j < MAX_2D_SIZE; j++) {
-            level->tiles[selY + i][selX + j] = copyBuffer[i][j];
+            setTile(level, selX + j, selY + i, copyBuffer[i][j]);
         }
     }
 
-    stack.push(edit);
+    pushChange(edit);
     emit edited();
 
     emit statusMessage(QString("Pasted (%1, %2) to (%3, %4)")
@@ -317,11 +528,11 @@ void MapScene::deleteTiles() {
     // otherwise, delete stuff
     for (int i = 0; i < selLength && selY + i < MAX_2D_SIZE; i++) {
         for (int j = 0; j < selWidth && selX + j < MAX_2D_SIZE; j++) {
-            level->tiles[selY + i][selX + j] = noTile;
+            setTile(level, selX + j, selY + i, noTile);
         }
     }
 
-    stack.push(edit);
+    pushChange(edit);
     emit edited();
 
     emit statusMessage(QString("Deleted (%1, %2) to (%3, %4)")
@@ -335,7 +546,8 @@ void MapScene::raiseTiles() {
     // if there is no selection, don't do anything
     if (selWidth == 0 || selLength == 0) return;
 
-    MapChange *edit = new MapChange(level, selX, selY, selWidth, selLength);
+    MapChange *edit = new MapChange(level, selX, selY, selWidth, selLength,
+                                    MapChange::heightChange);
     edit->setText("raise");
 
     bool changed = false;
@@ -343,21 +555,25 @@ void MapScene::raiseTiles() {
     // raise tiles (unless already max), and create them in empty spaces
     for (int i = 0; i < selLength && selY + i < MAX_2D_SIZE; i++) {
         for (int j = 0; j < selWidth && selX + j < MAX_2D_SIZE; j++) {
-            if(level->tiles[selY + i][selX + j].geometry == 0) {
-               level->tiles[selY + i][selX + j].geometry = 1;
-               level->tiles[selY + i][selX + j].height = 0;
+            maptile_t tile = level->tiles[selY + i][selX + j];
+
+            if(tile.geometry == 0) {
+               tile.geometry = 1;
+               tile.height = 0;
                changed = true;
             } else
-                if(level->tiles[selY + i][selX + j].height < MAX_HEIGHT) {
-                   level->tiles[selY + i][selX + j].height += 1;
+                if(tile.height < MAX_HEIGHT) {
+                   tile.height += 1;
                    changed = true;
                 }
+
+            setTile(level, selX + j, selY + i, tile);
         }
     }
 
     //only push to undo stack if something happened (to avoid undo's that do nothing)
     if(changed) {
-        stack.push(edit);
+        pushChange(edit);
         emit edited();
 
         emit statusMessage(QString("Raised (%1, %2) to (%3, %4)")
@@ -375,7 +591,8 @@ void MapScene::lowerTiles() {
     // if there is no selection, don't do anything
     if (selWidth == 0 || selLength == 0) return;
 
-    MapChange *edit = new MapChange(level, selX, selY, selWidth, selLength);
+    MapChange *edit = new MapChange(level, selX, selY, selWidth, selLength,
+                                    MapChange::heightChange);
     edit->setText("lower");
 
     bool changed = false;
@@ -383,20 +600,24 @@ void MapScene::lowerTiles() {
     // lower or remove tiles
     for (int i = 0; i < selLength && selY + i < MAX_2D_SIZE; i++) {
         for (int j = 0; j < selWidth && selX + j < MAX_2D_SIZE; j++) {
-            if(level->tiles[selY + i][selX + j].height > 0) {
-               level->tiles[selY + i][selX + j].height -= 1;
+            maptile_t tile = level->tiles[selY + i][selX + j];
+
+            if(tile.height > 0) {
+               tile.height -= 1;
                changed = true;
             } else      //if the tile is already at 0 and not blank, delete it
-                if(level->tiles[selY + i][selX + j].geometry) {
-                   level->tiles[selY + i][selX + j] = noTile;
+                if(tile.geometry) {
+                   tile = noTile;
                    changed = true;
             }
+
+            setTile(level, selX + j, selY + i, tile);
         }
     }
 
     //only push to undo stack if something happened (to avoid undo's that do nothing)
     if(changed) {
-        stack.push(edit);
+        pushChange(edit);
         emit edited();
 
         emit statusMessage(QString("Lowered (%1, %2) to (%3, %4)")
@@ -416,8 +637,8 @@ void MapScene::lowerTiles() {
 void MapScene::beginSelection(QMouseEvent *event) {
     QPointF pos = event->pos();
 
-    int x = floor(pos.x() / TILE_SIZE);
-    int y = floor(pos.y() / TILE_SIZE);
+    int x = floor(pos.x() / (TILE_SIZE * zoom));
+    int y = floor(pos.y() / (TILE_SIZE * zoom));
 
     // ignore invalid click positions
     // (use the floating point X coord to avoid roundoff stupidness)
@@ -444,8 +665,8 @@ void MapScene::updateSelection(QMouseEvent *event) {
 
     QPointF pos = event->pos();
 
-    x = floor(pos.x() / TILE_SIZE);
-    y = floor(pos.y() / TILE_SIZE);
+    x = floor(pos.x() / (TILE_SIZE * zoom));
+    y = floor(pos.y() / (TILE_SIZE * zoom));
 
     // ignore invalid mouseover/click positions
     // (use the floating point X coord to avoid roundoff stupidness)
@@ -475,7 +696,7 @@ void MapScene::updateSelection(QMouseEvent *event) {
     // also, pass the mouseover coords to the main window
     emit mouseOverTile(x, y);
 
-    update();
+    updateOverlays();
 }
 
 /*
@@ -489,26 +710,73 @@ void MapScene::showTileInfo(QMouseEvent *event) {
     QPointF pos = event->pos();
     // if the mouse is moved onto a different tile, erase the old one
     // and draw the new one
-    if (floor(pos.x() / TILE_SIZE) != tileX || floor(pos.y() / TILE_SIZE) != tileY) {
-        tileX = floor(pos.x() / TILE_SIZE);
-        tileY = floor(pos.y() / TILE_SIZE);
+    if (floor(pos.x() / (TILE_SIZE * zoom)) != tileX || floor(pos.y() / (TILE_SIZE * zoom)) != tileY) {
+        tileX = floor(pos.x() / (TILE_SIZE * zoom));
+        tileY = floor(pos.y() / (TILE_SIZE * zoom));
 
-        maptile_t tile = level->tiles[tileY][tileX];
         // show tile contents on the status bar
-        QString stat(QString("(%1,%2,%3)").arg(tileX).arg(tileY).arg(tile.height));
-        try {
-            stat.append(QString(" %1").arg(kirbyGeometry.at(tile.geometry)));
-
-            if (tile.obstacle)
-                stat.append(QString(" / %1").arg(kirbyObstacles.at(tile.obstacle)));
-        } catch (const std::out_of_range &dummy) {}
-
-        emit statusMessage(stat);
+        emit statusMessage(tileInfo(tileX, tileY));
 
         // also, pass the mouseover coords to the main window
         emit mouseOverTile(tileX, tileY);
     }
-    update();
+    updateOverlays();
+}
+
+/*
+  Get the coordinates and contents of a tile, for the status bar
+*/
+QString MapScene::tileInfo(int x, int y) const {
+    maptile_t tile = level->tiles[y][x];
+
+    QString stat(QString("(%1,%2,%3)").arg(x).arg(y).arg(tile.height));
+    try {
+        stat.append(QString(" %1").arg(kirbyGeometry.at(tile.geometry)));
+
+        if (tile.obstacle)
+            stat.append(QString(" / %1").arg(kirbyObstacles.at(tile.obstacle)));
+    } catch (const std::out_of_range &dummy) {}
+
+    return stat;
+}
+
+/*
+  Show the hover info for a tile that the mouse is over somewhere else (i.e. in the preview)
+  or for no tile at all, if it's off of the level
+*/
+void MapScene::hoverTile(int x, int y) {
+    if (x < 0 || y < 0 || x >= level->header.width || y >= level->header.length) {
+        tileX = tileY = -1;
+    } else {
+        tileX = x;
+        tileY = y;
+        emit statusMessage(tileInfo(x, y));
+    }
+
+    updateOverlays();
+}
+
+/*
+  Select a single tile (i.e. one clicked in the preview)
+*/
+void MapScene::selectTile(int x, int y) {
+    if (x < 0 || y < 0 || x >= level->header.width || y >= level->header.length)
+        return;
+
+    selecting = false;
+    selX = x;
+    selY = y;
+    selWidth = selLength = 1;
+
+    emit statusMessage(QString("Selected (%1, %2)").arg(x).arg(y));
+    updateOverlays();
+}
+
+/*
+  Get the area covered by a tile in widget coordinates (e.g. to scroll to it)
+*/
+QRect MapScene::tileRect(int x, int y) const {
+    return toWidget(QRect(x * TILE_SIZE, y * TILE_SIZE, TILE_SIZE, TILE_SIZE));
 }
 
 void MapScene::cancelSelection() {
@@ -516,235 +784,316 @@ void MapScene::cancelSelection() {
     selLength = 0;
     selX = 0;
     selY = 0;
-    update();
+    updateOverlays();
 }
 
-void MapScene::paintEvent(QPaintEvent *event) {
+/*
+  Finds a tile's graphics in the tile atlas, drawing them there first if they aren't already.
+  The source rect is TILE_SIZE pixels wide and at least TILE_SIZE pixels tall; obstacles
+  which are taller than a tile stick out of the top, so the bottom TILE_SIZE pixels are
+  always the tile itself.
+  Returns false if the tile isn't in the atlas and there's no room left for it.
+*/
+bool MapScene::tileSource(const maptile_t &tile, QRect *source) {
+    uint32_t key = tileKey(tile);
+
+    QHash<uint32_t, QRect>::const_iterator cached = tileSlots.constFind(key);
+    if (cached != tileSlots.constEnd()) {
+        *source = *cached;
+        return true;
+    }
+
+    if (tileSlots.size() >= MAP_ATLAS_COLUMNS * MAP_ATLAS_ROWS)
+        return false;
+
+    if (tileAtlas.isNull()) {
+        tileAtlas = QPixmap(MAP_ATLAS_COLUMNS * TILE_SIZE, MAP_ATLAS_ROWS * MAP_SLOT_HEIGHT);
+        tileAtlas.fill(Qt::transparent);
+    }
+
+    int slot = tileSlots.size();
+    QRect slotRect((slot % MAP_ATLAS_COLUMNS) * TILE_SIZE, (slot / MAP_ATLAS_COLUMNS) * MAP_SLOT_HEIGHT,
+                   TILE_SIZE, MAP_SLOT_HEIGHT);
+
+    QPainter painter(&tileAtlas);
+    // clear out whatever tile used this slot before
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(slotRect, Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    // draw the tile at the bottom of the slot
+    painter.translate(slotRect.left(), slotRect.top() + MAP_SLOT_HEIGHT - TILE_SIZE);
+    int height = drawTile(painter, tile);
+    painter.end();
+
+    *source = QRect(slotRect.left(), slotRect.top() + MAP_SLOT_HEIGHT - height, TILE_SIZE, height);
+    tileSlots.insert(key, *source);
+    atlasHalfDirty = true;
+    return true;
+}
+
+/*
+  Get the tile atlas at full size (level 0) or half size (level 1)
+*/
+const QPixmap& MapScene::atlasLevel(int mip) {
+    if (mip == 0)
+        return tileAtlas;
+
+    if (atlasHalfDirty) {
+        tileAtlasHalf = tileAtlas.scaled(tileAtlas.size() / 2,
+                                         Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        atlasHalfDirty = false;
+    }
+    return tileAtlasHalf;
+}
+
+/*
+  Draw the exposed part of the map (in map coordinates) with all of its graphics
+*/
+void MapScene::drawDetail(QPainter &painter, const QRect &rect) {
     int width = level->header.width;
     int height = level->header.length;
 
-    // no width/height = don't draw anything
-    if (width + height == 0) {
-        return;
+    // use the half size atlas when zoomed out
+    int mip = zoom < 1.0 ? 1 : 0;
+    double mipScale = 1 << mip;
+
+    // gather up each tile's graphics from the tile atlas and draw them all at once
+    // (including the row below, in case any obstacles there stick up into this area)
+    QVector<QPainter::PixmapFragment> fragments;
+    for (int h = rect.top() / TILE_SIZE; h < MAX_2D_SIZE && h <= rect.bottom() / TILE_SIZE + 1; h++) {
+        for (int w = rect.left() / TILE_SIZE; w < MAX_2D_SIZE && w <= rect.right() / TILE_SIZE; w++) {
+            const maptile_t &tile = level->tiles[h][w];
+            // (empty space with no obstacle, bumpers or flags)
+            if (!tileKey(tile)) continue;
+
+            QRect source;
+            if (!tileSource(tile, &source)) {
+                // out of room in the atlas - draw what's there so far and start over
+                painter.drawPixmapFragments(fragments.constData(), fragments.size(), atlasLevel(mip));
+                fragments.clear();
+                tileSlots.clear();
+                tileSource(tile, &source);
+            }
+
+            // (fragments are positioned by their center)
+            fragments.append(QPainter::PixmapFragment::create(
+                                 QPointF(w * TILE_SIZE + TILE_SIZE / 2.0,
+                                         (h + 1) * TILE_SIZE - source.height() / 2.0),
+                                 QRectF(source.x() / mipScale, source.y() / mipScale,
+                                        source.width() / mipScale, source.height() / mipScale),
+                                 mipScale, mipScale));
+        }
     }
+    painter.drawPixmapFragments(fragments.constData(), fragments.size(), atlasLevel(mip));
 
-    // assign a painter to the target pixmap
-    QPainter painter(this);
-    QString infoText;
-    QRect infoRect;
+    // draw tile grid (all in one go)
+    QVector<QLine> grid;
+    for (int h = TILE_SIZE; h < height * TILE_SIZE; h += TILE_SIZE)
+        grid.append(QLine(0, h, width * TILE_SIZE, h));
+    for (int w = TILE_SIZE; w < width * TILE_SIZE; w += TILE_SIZE)
+        grid.append(QLine(w, 0, w, height * TILE_SIZE));
+    painter.drawLines(grid);
+}
 
-    QRect rect = event->rect();
+/*
+  Redraw the overview images, where each tile is a small glyph colored by its height,
+  with a dot in the middle colored by its obstacle
+*/
+void MapScene::updateOverview() {
+    int width = level->header.width;
+    int height = level->header.length;
+    int size = MAP_GLYPH_SIZE;
 
-    // slowly blit shit from the tile resource onto the pixmap
-    for (int h = rect.top() / TILE_SIZE; h < MAX_2D_SIZE && h <= rect.bottom() / TILE_SIZE; h++) {
-        for (int w = rect.left() / TILE_SIZE; w < MAX_2D_SIZE && w <= rect.right() / TILE_SIZE; w++) {
-            maptile_t *tile = &level->tiles[h][w];
-            int geo = tile->geometry;
-            if (geo) {
-                painter.drawPixmap(w * TILE_SIZE, h * TILE_SIZE,
-                                   tiles,
-                                   (geo - 1) * TILE_SIZE, 0,
-                                   TILE_SIZE, TILE_SIZE);
+    QImage image(width * size, height * size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setPen(QColor(0, 0, 0, 64));
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const maptile_t &tile = level->tiles[y][x];
+            QRect cell(x * size, y * size, size, size);
+
+            if (tile.geometry) {
+                // green (low) to red (high), and a bit darker for slopes
+                QColor color = QColor::fromHsv(qMax(0, 120 - tile.height * 8), 140, 200);
+                if (tile.geometry >= stuff::slopes)
+                    color = color.darker(125);
+
+                painter.fillRect(cell, color);
+                painter.drawRect(cell.adjusted(0, 0, -1, -1));
             }
 
-            // include obstacles and all other stuff in the same pass
-            int obs = tile->obstacle;
-
-            QPixmap gfx;
-            int frame = 0;
-
-            /*
-             *
-             * START OF KIRBY OBSTACLE CHECK
-             * (TODO: move the enum from metatile.h and use it instead of magic numbers
-             */
-
-            // whispy woods (index 0x00 in enemies.png)
-            if (obs == 0x02) {
-                gfx = enemies;
-                frame = 0;
-
-            // sand trap (index 0 in traps.png)
-            } else if (obs == 0x04) {
-                gfx = traps;
-                frame = 0;
-
-            // spike pit (index 1 in traps.png)
-            } else if (obs == 0x05) {
-                gfx = traps;
-                frame = 1;
-
-            // kirby's start pos (kirby.png)
-            } else if (obs == 0x0c) {
-                gfx = kirby;
-                frame = 0;
-
-            // dedede (frame 0 in dedede.png)
-            } else if (obs == 0x0d) {
-                gfx = dedede;
-                frame = 0;
-
-            // current, arrows, boosters, vents
-            // (ind. 00 to 0d in movers.png)
-            } else if (obs >= 0x10 && obs <= 0x1d) {
-                gfx = movers;
-                frame = obs - 0x10;
-
-            // bouncy pads (ind. 0 to 4 in bounce.png)
-            } else if (obs >= 0x20 && obs <= 0x24) {
-                gfx = bounce;
-                frame = obs - 0x20;
-
-            // bumpers (start at index 4 in bumpers.png)
-            } else if (obs >= 0x28 && obs <= 0x2d) {
-                gfx = bumpers;
-                frame = obs - 0x28 + 4;
-
-            // conveyor belts (ind. 0 to b in conveyor.png)
-            } else if (obs >= 0x30 && obs <= 0x3b) {
-                gfx = conveyor;
-                frame = obs - 0x30;
-
-            // most enemies (ind. 01 to 13 in enemies.png)
-            } else if (obs >= 0x40 && obs <= 0x52) {
-                gfx = enemies;
-                frame = obs - 0x40 + 1;
-
-            // transformer (ind. 14 in enemies.png
-            } else if (obs == 0x57) {
-                gfx = enemies;
-                frame = 0x14;
-
-            // switches (ind. 0 to 5 in switches.png)
-            } else if (obs >= 0x58 && obs <= 0x5d) {
-                gfx = switches;
-                frame = obs - 0x58;
-
-            // water hazards (ind. 0 to e in water.png)
-            // (note types 62 & 63 seem unused)
-            } else if (obs >= 0x61 && obs <= 0x6f) {
-                gfx = water;
-                frame = obs - 0x61;
-
-            // rotating spaces (ind. 0-b in rotate.png)
-            } else if (obs >= 0x70 && obs <= 0x7b) {
-                gfx = rotate;
-                frame = obs & 0x01;
-
-            // gordo (ind. 00 to 21 in gordo.png)
-            } else if (obs >= 0x80 && obs <= 0xa1) {
-                gfx = gordo;
-                frame = obs - 0x80;
-
-            // kracko (index 15-17 in enemies.png)
-            } else if (obs >= 0xac && obs <= 0xae) {
-                gfx = enemies;
-                frame = obs - 0xac + 0x15;
-
-            // warps (ind. 0 to 9 in warps.png)
-            } else if (obs >= 0xb0 && obs <= 0xb9) {
-                gfx = warps;
-                frame = obs - 0xb0;
-
-            // starting line (ind. 1 to 4 in dedede.png)
-            } else if (obs >= 0xc0 && obs <= 0xc3) {
-                gfx = dedede;
-                frame = obs - 0xc0 + 1;
-
-            // anything else - question mark (or don't draw)
-            } else {
+            uint sheet = obstacleSprites[tile.obstacle].sheet2D;
+            if (sheet != spriteNone)
+                painter.fillRect(cell.adjusted(size / 4, size / 4, -size / 4, -size / 4),
+                                 QColor(glyphColors[sheet]));
+        }
+    }
+    painter.end();
+
+    overview[0] = image;
+    for (int i = 1; i < MAP_GLYPH_LEVELS; i++)
+        overview[i] = overview[i - 1].scaled(overview[i - 1].size() / 2,
+                                             Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    overviewDirty = false;
+}
+
+/*
+  Draw the exposed part of the map (in map coordinates) using the overview images
+*/
+void MapScene::drawOverview(QPainter &painter, const QRect &rect) {
+    if (overviewDirty)
+        updateOverview();
+
+    // use the smallest overview image that's still at least as big as what's being drawn
+    double tileSize = TILE_SIZE * zoom;
+    int lod = 0;
+    while (lod < MAP_GLYPH_LEVELS - 1 && (MAP_GLYPH_SIZE >> (lod + 1)) >= tileSize)
+        lod++;
+
+    double scale = (double)TILE_SIZE / (MAP_GLYPH_SIZE >> lod);
+    QRect target = rect & QRect(0, 0, level->header.width * TILE_SIZE, level->header.length * TILE_SIZE);
+
+    painter.drawImage(QRectF(target), overview[lod],
+                      QRectF(target.x() / scale, target.y() / scale,
+                             target.width() / scale, target.height() / scale));
+}
+
+/*
+  Draws a single tile (terrain, obstacle, bumpers and labels) at (0, 0).
+  Returns the height of what was drawn, including any part of the obstacle
+  above the tile.
+*/
+int MapScene::drawTile(QPainter &painter, const maptile_t &tile) {
+    int geo = tile.geometry;
+    // include obstacles and all other stuff in the same pass
+    int obs = tile.obstacle;
+
+    const obstacle_t &sprite = obstacleSprites[obs];
+    const QPixmap *gfx = &sprites[sprite.sheet2D];
+    int frame = sprite.frame2D;
+
+    // anything else - question mark (or don't draw)
+    if (sprite.sheet2D == spriteNone) {
 #ifdef QT_DEBUG
-                gfx = unknown;
-                frame = 0;
+        gfx = &sprites[spriteUnknown];
+        frame = 0;
 #else
-                obs = 0;
+        obs = 0;
 #endif
-            }
+    }
 
-            /*
-             *
-             * END OF KIRBY OBSTACLE CHECK
-             *
-             */
-
-            // draw the selected obstacle
-            if (obs) {
-                painter.drawPixmap(w * TILE_SIZE,
-                                   (h + 1) * TILE_SIZE - gfx.height(),
-                                   gfx, frame * TILE_SIZE, 0,
-                                   TILE_SIZE, gfx.height());
-            }
+    QString infoText;
+    QRect infoRect;
 
-            // render side bumpers (ind. 0 - 3 in bumpers.png)
-            if (tile->flags.bumperSouth)
-                painter.drawPixmap(w * TILE_SIZE, h * TILE_SIZE,
-                                   bumpers, 0 * TILE_SIZE, 0,
-                                   TILE_SIZE, TILE_SIZE);
-            if (tile->flags.bumperEast)
-                painter.drawPixmap(w * TILE_SIZE, h * TILE_SIZE,
-                                   bumpers, 1 * TILE_SIZE, 0,
-                                   TILE_SIZE, TILE_SIZE);
-            if (tile->flags.bumperNorth)
-                painter.drawPixmap(w * TILE_SIZE, h * TILE_SIZE,
-                                   bumpers, 2 * TILE_SIZE, 0,
-                                   TILE_SIZE, TILE_SIZE);
-            if (tile->flags.bumperWest)
-                painter.drawPixmap(w * TILE_SIZE, h * TILE_SIZE,
-                                   bumpers, 3 * TILE_SIZE, 0,
-                                   TILE_SIZE, TILE_SIZE);
-
-            painter.setFont(MapScene::infoFont);
-
-            if (geo) {
-                infoText = QString("%1").arg(tile->height, 2);
-                infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
-
-                painter.fillRect((w+1) * TILE_SIZE - infoRect.width() - 2 * MAP_TEXT_PAD_H,
-                                 (h+1) * TILE_SIZE - infoRect.height() - MAP_TEXT_PAD_V,
-                                 infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
-                                 MapScene::infoColor);
-                painter.drawText(w * TILE_SIZE + MAP_TEXT_PAD_H - 1, h * TILE_SIZE + MAP_TEXT_PAD_V,
-                                 TILE_SIZE - MAP_TEXT_PAD_H, TILE_SIZE - MAP_TEXT_PAD_V,
-                                 Qt::AlignRight | Qt::AlignBottom,
-                                 infoText);
-            }
+    if (geo) {
+        painter.drawPixmap(0, 0,
+                           tiles,
+                           (geo - 1) * TILE_SIZE, 0,
+                           TILE_SIZE, TILE_SIZE);
+    }
+
+    // draw the selected obstacle
+    if (obs) {
+        painter.drawPixmap(0, TILE_SIZE - gfx->height(),
+                           *gfx, frame * TILE_SIZE, 0,
+                           TILE_SIZE, gfx->height());
+    }
+
+    // render side bumpers (ind. 0 - 3 in bumpers.png)
+    if (tile.flags.bumperSouth)
+        painter.drawPixmap(0, 0,
+                           sprites[spriteBumpers], 0 * TILE_SIZE, 0,
+                           TILE_SIZE, TILE_SIZE);
+    if (tile.flags.bumperEast)
+        painter.drawPixmap(0, 0,
+                           sprites[spriteBumpers], 1 * TILE_SIZE, 0,
+                           TILE_SIZE, TILE_SIZE);
+    if (tile.flags.bumperNorth)
+        painter.drawPixmap(0, 0,
+                           sprites[spriteBumpers], 2 * TILE_SIZE, 0,
+                           TILE_SIZE, TILE_SIZE);
+    if (tile.flags.bumperWest)
+        painter.drawPixmap(0, 0,
+                           sprites[spriteBumpers], 3 * TILE_SIZE, 0,
+                           TILE_SIZE, TILE_SIZE);
+
+    painter.setFont(MapScene::infoFont);
+
+    if (geo) {
+        infoText = QString("%1").arg(tile.height, 2);
+        infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
+
+        painter.fillRect(TILE_SIZE - infoRect.width() - 2 * MAP_TEXT_PAD_H,
+                         TILE_SIZE - infoRect.height() - MAP_TEXT_PAD_V,
+                         infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
+                         MapScene::infoColor);
+        painter.drawText(MAP_TEXT_PAD_H - 1, MAP_TEXT_PAD_V,
+                         TILE_SIZE - MAP_TEXT_PAD_H, TILE_SIZE - MAP_TEXT_PAD_V,
+                         Qt::AlignRight | Qt::AlignBottom,
+                         infoText);
+    }
 
 #ifdef QT_DEBUG
-            if (tile->flags.layer || tile->flags.dummy) {
-                infoText.sprintf("%02X", tile->flags);
+    if (tile.flags.layer || tile.flags.dummy) {
+        infoText.sprintf("%02X", tile.flags);
 #else
-            if (tile->flags.layer) {
-                infoText = "L2";
+    if (tile.flags.layer) {
+        infoText = "L2";
 #endif
-                infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
-
-                painter.fillRect((w+1) * TILE_SIZE - infoRect.width() - 2 * MAP_TEXT_PAD_H,
-                                 h * TILE_SIZE,
-                                 infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
-                                 MapScene::layerColor);
-                painter.drawText(w * TILE_SIZE + MAP_TEXT_PAD_H - 1, h * TILE_SIZE,
-                                 TILE_SIZE - MAP_TEXT_PAD_H, TILE_SIZE - MAP_TEXT_PAD_V,
-                                 Qt::AlignRight | Qt::AlignTop,
-                                 infoText);
-            }
-        }
+        infoRect = MapScene::infoFontMetrics.boundingRect(infoText);
+
+        painter.fillRect(TILE_SIZE - infoRect.width() - 2 * MAP_TEXT_PAD_H,
+                         0,
+                         infoRect.width() + 2 * MAP_TEXT_PAD_H, infoRect.height() + MAP_TEXT_PAD_V,
+                         MapScene::layerColor);
+        painter.drawText(MAP_TEXT_PAD_H - 1, 0,
+                         TILE_SIZE - MAP_TEXT_PAD_H, TILE_SIZE - MAP_TEXT_PAD_V,
+                         Qt::AlignRight | Qt::AlignTop,
+                         infoText);
     }
 
-    // draw tile grid
-    for (int h = TILE_SIZE; h < height * TILE_SIZE; h += TILE_SIZE)
-        painter.drawLine(0, h, width * TILE_SIZE, h);
-    for (int w = TILE_SIZE; w < width * TILE_SIZE; w += TILE_SIZE)
-        painter.drawLine(w, 0, w, height * TILE_SIZE);
+    return TILE_SIZE + (obs ? qMax(0, gfx->height() - TILE_SIZE) : 0);
+}
+
+void MapScene::paintEvent(QPaintEvent *event) {
+    int width = level->header.width;
+    int height = level->header.length;
+
+    // no width/height = don't draw anything
+    if (width + height == 0) {
+        return;
+    }
+
+    // assign a painter to the target pixmap
+    QPainter painter(this);
+    QString infoText;
+    QRect infoRect;
+
+    // everything is drawn in unzoomed map coordinates
+    QRect rect = toMap(event->rect());
+    painter.scale(zoom, zoom);
+    if (zoom != 1.0)
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    bool detail = zoom >= MAP_DETAIL_ZOOM;
+    if (detail)
+        drawDetail(painter, rect);
+    else
+        drawOverview(painter, rect);
+
     painter.setPen(Qt::black);
     painter.drawRect(0, 0, width * TILE_SIZE, height * TILE_SIZE);
 
     // ignore invalid mouseover positions
-    // (use the floating point X coord to avoid roundoff stupidness)
-    if (tileX < level->header.width && tileY < level->header.length
-           && tileX >= 0 && tileY >= 0) {
+    QRect hover = hoverRect();
+    if (!hover.isEmpty()) {
 
-        uint infoX = tileX * TILE_SIZE;
-        uint infoY = tileY * TILE_SIZE;
+        uint infoX = hover.left();
+        uint infoY = hover.top();
 
         // render background
         painter.fillRect(infoX, infoY, TILE_SIZE, TILE_SIZE,
@@ -755,7 +1104,8 @@ void MapScene::paintEvent(QPaintEvent *event) {
         maptile_t tile = level->tiles[tileY][tileX];
 
         // only draw bottom part if terrain != 0 (i.e. not empty space)
-        if (tile.geometry) {
+        // (and there's enough room for it)
+        if (tile.geometry && detail) {
             // bottom corner: terrain + obstacle
             infoText = QString("%1 %2")
                                .arg((uint)tile.geometry, 2, 16, QLatin1Char('0'))
@@ -777,11 +1127,7 @@ void MapScene::paintEvent(QPaintEvent *event) {
     }
 
     // draw selection
-    if (selWidth != 0 && selLength != 0) {
-        // account for selections in either negative direction
-        int selLeft = qMin(selX, selX + selWidth + 1);
-        int selTop  = qMin(selY, selY + selLength + 1);
-        QRect selArea(selLeft * TILE_SIZE, selTop * TILE_SIZE, abs(selWidth) * TILE_SIZE, abs(selLength) * TILE_SIZE);
+    QRect selArea = selectionRect();
+    if (!selArea.isEmpty())
         painter.fillRect(selArea, MapScene::selectionColor);
-    }
 }
@@ -6,11 +6,23 @@
 #ifndef MAPSCENE_H
 #define MAPSCENE_H
 
+#include <cstdint>
 #include <QWidget>
+#include <QHash>
+#include <QList>
 #include <QMouseEvent>
 #include <QtWidgets/QUndoStack>
 #include <QFontMetrics>
+#include <QPainter>
 #include "level.h"
+#include "mapchange.h"
+#include "obstaclesprites.h"
+
+// number of overview images used when the map is zoomed out
+// (each one is half the size of the last)
+#define MAP_GLYPH_LEVELS 3
+// default limit for the memory used by undo history (see MapScene::setUndoMemory)
+#define MAP_UNDO_MEMORY (16 * 1024 * 1024)
 
 // subclass of QGraphicsScene used to draw the 2d map and handle mouse/kb events for it
 class MapScene : public QWidget {
@@ -26,24 +38,78 @@ private:
     int tileX, tileY;
     int selX, selY, selLength, selWidth;
     bool selecting;
+    // where the hover info and selection were last drawn
+    QRect shownHover, shownSelection;
 
     maptile_t copyBuffer[MAX_2D_SIZE][MAX_2D_SIZE];
     uint copyWidth, copyLength;
 
-    QUndoStack stack;
+    // undo history for each level (by level number), and the current level's
+    QHash<int, QUndoStack*> stacks;
+    QUndoStack *stack;
+    int         undoLevel;
+    // levels other than the current one which have undo history,
+    // from least to most recently used
+    QList<int>  usedStacks;
+    size_t      undoMemory;
 
     leveldata_t *level;
 
+    double zoom;
+
     //QGraphicsPixmapItem *infoItem, *selectionItem;
 
-    QPixmap tiles, kirby, enemies, traps, bounce, movers, rotate,
-            conveyor, bumpers, water, warps, gordo, switches, dedede,
-            unknown;
+    QPixmap tiles;
+    // obstacle sprite sheets (see obstaclesprites.h)
+    QPixmap sprites[NUM_SPRITE_SHEETS];
+
+    // fully drawn graphics for each different tile, packed into one pixmap so that
+    // the whole map can be drawn at once (kept between levels)
+    QPixmap tileAtlas;
+    // the same thing at half size, for drawing while zoomed out
+    QPixmap tileAtlasHalf;
+    bool    atlasHalfDirty;
+    // where each tile is in the atlas (indexed by tileKey)
+    QHash<uint32_t, QRect> tileSlots;
+
+    // everything that affects how a tile looks, packed into 32 bits
+    static inline uint32_t tileKey(const maptile_t &tile) {
+        uint32_t flags = tile.flags.bumperSouth
+                       | (tile.flags.bumperEast  << 1)
+                       | (tile.flags.bumperNorth << 2)
+                       | (tile.flags.bumperWest  << 3)
+                       | (tile.flags.dummy       << 4)
+                       | (tile.flags.layer       << 7);
+        return tile.geometry | (tile.obstacle << 8) | (tile.height << 16) | (flags << 24);
+    }
+    bool tileSource(const maptile_t &tile, QRect *source);
+    int  drawTile(QPainter &painter, const maptile_t &tile);
+    const QPixmap& atlasLevel(int mip);
+
+    // the whole level drawn as simple glyphs at a few different sizes, for drawing while
+    // zoomed out (largest first)
+    QImage overview[MAP_GLYPH_LEVELS];
+    bool   overviewDirty;
+    void updateOverview();
+
+    void drawDetail(QPainter &painter, const QRect &rect);
+    void drawOverview(QPainter &painter, const QRect &rect);
+
+    void resizeMap();
+    QRect toMap(const QRect &rect) const;
+    QRect toWidget(const QRect &rect) const;
 
     void copyTiles(bool cut);
     void showTileInfo(QMouseEvent *event);
+    QString tileInfo(int x, int y) const;
     void beginSelection(QMouseEvent *event);
     void updateSelection(QMouseEvent *event = NULL);
+    QRect hoverRect() const;
+    QRect selectionRect() const;
+    void updateOverlays();
+
+    void pushChange(MapChange *change);
+    void trimStacks();
 
 public:
     explicit MapScene(QWidget *parent = 0, leveldata_t *currentLevel = 0);
@@ -54,6 +120,13 @@ public:
 
     void cancelSelection();
 
+    void setUndoLevel(int levelNum);
+    void clearStack(int levelNum);
+    void clearAllStacks();
+    void setUndoMemory(size_t bytes);
+
+    QRect tileRect(int x, int y) const;
+
 public slots:
     void editTiles();
     void undo();
@@ -67,6 +140,12 @@ public slots:
     void raiseTiles();
     void lowerTiles();
     void refresh(bool keepMouse = true);
+    void setZoom(double zoom);
+    void zoomIn();
+    void zoomOut();
+    void resetZoom();
+    void hoverTile(int x, int y);
+    void selectTile(int x, int y);
 
 signals:
     void doubleClicked();
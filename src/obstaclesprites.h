@@ -0,0 +1,150 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef OBSTACLESPRITES_H
+#define OBSTACLESPRITES_H
+
+#include <cstdint>
+
+// sprite sheets used to draw obstacles
+enum {
+    spriteNone,
+    spriteBounce,
+    spriteBumpers,
+    spriteConveyor,
+    spriteDedede,
+    spriteEnemies,
+    spriteGordo,
+    spriteKirby,
+    spriteMovers,
+    spriteRotate,
+    spriteSwitches,
+    spriteTraps,
+    spriteWarps,
+    spriteWater,
+    spriteUnknown,
+    NUM_SPRITE_SHEETS
+};
+
+// image file for each sprite sheet in the 2D map and in the 3D preview
+// (null = not used there)
+constexpr const char* spriteFiles2D[NUM_SPRITE_SHEETS] = {
+    nullptr,
+    ":images/bounce.png",
+    ":images/bumpers.png",
+    ":images/conveyor.png",
+    ":images/dedede.png",
+    ":images/enemies.png",
+    ":images/gordo.png",
+    ":images/kirby.png",
+    ":images/movers.png",
+    ":images/rotate.png",
+    ":images/switches.png",
+    ":images/traps.png",
+    ":images/warps.png",
+    ":images/water.png",
+    ":images/unknown.png"
+};
+
+constexpr const char* spriteFiles3D[NUM_SPRITE_SHEETS] = {
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    ":images/dedede.png",
+    ":images/enemies.png",
+    ":images/gordo3d.png",
+    ":images/kirby.png",
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr
+};
+
+/*
+  Which sprite (sheet and frame) an obstacle is drawn with in the 2D map and in the 3D preview.
+  Each frame is TILE_SIZE pixels wide and as tall as its sheet; sprites are lined up with
+  the bottom of the tile (2D) or with the surface of the tile (3D), so taller ones stick up
+  above it.
+*/
+typedef struct {
+    uint8_t sheet2D, frame2D;
+    uint8_t sheet3D, frame3D;
+} obstacle_t;
+
+constexpr obstacle_t obstacleBoth(unsigned sheet, unsigned frame) {
+    return obstacle_t {(uint8_t)sheet, (uint8_t)frame, (uint8_t)sheet, (uint8_t)frame};
+}
+
+constexpr obstacle_t obstacle2D(unsigned sheet, unsigned frame) {
+    return obstacle_t {(uint8_t)sheet, (uint8_t)frame, spriteNone, 0};
+}
+
+constexpr obstacle_t obstacleSprite(unsigned obs) {
+    return
+        // whispy woods (index 0x00 in enemies.png)
+        obs == 0x02 ? obstacleBoth(spriteEnemies, 0) :
+        // sand trap and spike pit (index 0 and 1 in traps.png)
+        obs == 0x04 ? obstacle2D(spriteTraps, 0) :
+        obs == 0x05 ? obstacle2D(spriteTraps, 1) :
+        // kirby's start pos (kirby.png)
+        obs == 0x0c ? obstacleBoth(spriteKirby, 0) :
+        // dedede (frame 0 in dedede.png)
+        obs == 0x0d ? obstacleBoth(spriteDedede, 0) :
+        // current, arrows, boosters, vents (ind. 00 to 0d in movers.png)
+        (obs >= 0x10 && obs <= 0x1d) ? obstacle2D(spriteMovers, obs - 0x10) :
+        // bouncy pads (ind. 0 to 4 in bounce.png)
+        (obs >= 0x20 && obs <= 0x24) ? obstacle2D(spriteBounce, obs - 0x20) :
+        // bumpers (start at index 4 in bumpers.png)
+        (obs >= 0x28 && obs <= 0x2d) ? obstacle2D(spriteBumpers, obs - 0x28 + 4) :
+        // conveyor belts (ind. 0 to b in conveyor.png)
+        (obs >= 0x30 && obs <= 0x3b) ? obstacle2D(spriteConveyor, obs - 0x30) :
+        // most enemies (ind. 01 to 13 in enemies.png)
+        (obs >= 0x40 && obs <= 0x52) ? obstacleBoth(spriteEnemies, obs - 0x40 + 1) :
+        // transformer (ind. 14 in enemies.png)
+        obs == 0x57 ? obstacleBoth(spriteEnemies, 0x14) :
+        // switches (ind. 0 to 5 in switches.png)
+        (obs >= 0x58 && obs <= 0x5d) ? obstacle2D(spriteSwitches, obs - 0x58) :
+        // water hazards (ind. 0 to e in water.png)
+        // (note types 62 & 63 seem unused)
+        (obs >= 0x61 && obs <= 0x6f) ? obstacle2D(spriteWater, obs - 0x61) :
+        // rotating spaces (ind. 0-1 in rotate.png)
+        (obs >= 0x70 && obs <= 0x7b) ? obstacle2D(spriteRotate, obs & 0x01) :
+        // gordo (ind. 00 to 21 in gordo.png, but only 00 to 17 in 3D)
+        (obs >= 0x80 && obs <= 0x97) ? obstacleBoth(spriteGordo, obs - 0x80) :
+        (obs >= 0x98 && obs <= 0xa1) ? obstacle2D(spriteGordo, obs - 0x80) :
+        // kracko (index 15-17 in enemies.png)
+        (obs >= 0xac && obs <= 0xae) ? obstacleBoth(spriteEnemies, obs - 0xac + 0x15) :
+        // warps (ind. 0 to 9 in warps.png)
+        (obs >= 0xb0 && obs <= 0xb9) ? obstacle2D(spriteWarps, obs - 0xb0) :
+        // starting line (ind. 1 to 4 in dedede.png)
+        // (the 3D preview shows kirby instead of the final boss version)
+        (obs >= 0xc0 && obs <= 0xc2) ? obstacle2D(spriteDedede, obs - 0xc0 + 1) :
+        obs == 0xc3 ? obstacle_t {spriteDedede, 4, spriteKirby, 0} :
+        // anything else - nothing
+        obstacle2D(spriteNone, 0);
+}
+
+#define OBSTACLE_ROW(n) \
+    obstacleSprite(n + 0x0), obstacleSprite(n + 0x1), obstacleSprite(n + 0x2), obstacleSprite(n + 0x3), \
+    obstacleSprite(n + 0x4), obstacleSprite(n + 0x5), obstacleSprite(n + 0x6), obstacleSprite(n + 0x7), \
+    obstacleSprite(n + 0x8), obstacleSprite(n + 0x9), obstacleSprite(n + 0xa), obstacleSprite(n + 0xb), \
+    obstacleSprite(n + 0xc), obstacleSprite(n + 0xd), obstacleSprite(n + 0xe), obstacleSprite(n + 0xf)
+
+// sprites for every obstacle type, indexed by obstacle number
+// (obstacles with no sprite use spriteNone)
+constexpr obstacle_t obstacleSprites[256] = {
+    OBSTACLE_ROW(0x00), OBSTACLE_ROW(0x10), OBSTACLE_ROW(0x20), OBSTACLE_ROW(0x30),
+    OBSTACLE_ROW(0x40), OBSTACLE_ROW(0x50), OBSTACLE_ROW(0x60), OBSTACLE_ROW(0x70),
+    OBSTACLE_ROW(0x80), OBSTACLE_ROW(0x90), OBSTACLE_ROW(0xa0), OBSTACLE_ROW(0xb0),
+    OBSTACLE_ROW(0xc0), OBSTACLE_ROW(0xd0), OBSTACLE_ROW(0xe0), OBSTACLE_ROW(0xf0)
+};
+
+#undef OBSTACLE_ROW
+
+#endif // OBSTACLESPRITES_H
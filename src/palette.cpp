@@ -0,0 +1,220 @@
+/*
+  palette.cpp
+
+  Contains functions for reading the courses' foreground/water palettes from the ROM and
+  applying them to the color tables of the 3D tile sheets.
+
+  The tile sheets are stored as indexed images, so recoloring them only means changing
+  their color tables. Since the exact order of the colors in the tile sheets doesn't match
+  the order in the game's palettes, each band of a sheet is matched to the palette it was
+  originally made with, and each of the band's colors is then replaced by the color at the
+  same position in the selected palette.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include "palette.h"
+
+// minimum number of tile sheet colors which have to be found in a palette
+// before it's considered to be the one the tile sheet was made with
+#define PALETTE_MIN_MATCHES 8
+
+QRgb snesColor(uint16_t color) {
+    int r = color & 0x1F;
+    int g = (color >> 5) & 0x1F;
+    int b = (color >> 10) & 0x1F;
+
+    // scale 5-bit components up to 8-bit
+    return qRgb((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2));
+}
+
+/*
+  Compares two colors as the SNES would see them (i.e. only the top 5 bits of each component.)
+  Transparent colors (including anything in a palette that isn't really a color) never match.
+*/
+static inline bool sameColor(QRgb a, QRgb b) {
+    return qAlpha(a) && qAlpha(b) && ((a ^ b) & 0xF8F8F8) == 0;
+}
+
+/*
+  Reads a palette from the ROM. Anything which can't be an SNES color (i.e. has the highest
+  bit set) becomes a transparent entry, and 'valid' is set to false.
+*/
+static QVector<QRgb> readColors(ROMFile &rom, uint addr, uint size, bool *valid = NULL) {
+    QVector<QRgb> colors;
+
+    for (uint i = 0; i < size; i += 2) {
+        uint16_t color = rom.readInt16(addr + i);
+
+        if (color & 0x8000) {
+            colors.append(qRgba(0, 0, 0, 0));
+            if (valid) *valid = false;
+        } else {
+            colors.append(snesColor(color));
+        }
+    }
+
+    return colors;
+}
+
+/*
+  Checks that a pointer from one of the course palette tables points to one of the palettes
+  (the same way MainWindow works out each course's palette number.)
+*/
+static inline bool validPointer(uint ptr, uint base, uint size) {
+    return ptr >= base && (ptr - base) % size == 0 && (ptr - base) / size < NUM_FG_PALETTES;
+}
+
+void readPalettes(ROMFile &rom, palettes_t *palettes) {
+    *palettes = palettes_t();
+
+    // (no palettes for STS yet)
+    if (rom.getGame() != ROMFile::kirby)
+        return;
+
+    int ver = rom.getVersion();
+
+    // make sure every course's palettes are where they're expected to be before using them,
+    // in case this ROM doesn't quite match the others
+    bool fgValid = true, waterValid = true;
+    for (int i = 0; i < 28; i++) {
+        uint day   = rom.readInt16(paletteTable[ver] + 2 * i);
+        uint night = rom.readInt16(paletteTable[ver] + 2 * (i + 33));
+        uint water = rom.readInt16(waterTable[0][ver] + 2 * i);
+
+        // nighttime palettes come after all of the daytime ones
+        fgValid    &= validPointer(day, fgPaletteBase[ver], FG_PALETTE_SIZE)
+                   && night == day + NUM_FG_PALETTES * FG_PALETTE_SIZE;
+        waterValid &= validPointer(water, waterBase[0][ver], WATER_PALETTE_SIZE);
+    }
+
+    // the pointers are only 16 bits, so the palettes are assumed to be in the same banks as
+    // the tables which point to them (in every version, the foreground palettes come right
+    // after their pointer table.) if that's wrong, the data won't look like palettes
+    uint fgBank    = paletteTable[ver]  & 0xFF0000;
+    uint waterBank = waterTable[0][ver] & 0xFF0000;
+
+    for (int i = 0; i < NUM_FG_PALETTES && fgValid; i++) {
+        uint addr = fgBank | (fgPaletteBase[ver] + i * FG_PALETTE_SIZE);
+
+        palettes->fg[0][i] = readColors(rom, addr, FG_PALETTE_SIZE, &fgValid);
+        palettes->fg[1][i] = readColors(rom, addr + NUM_FG_PALETTES * FG_PALETTE_SIZE,
+                                        FG_PALETTE_SIZE, &fgValid);
+    }
+
+    // the water palettes also have other data mixed in with them (the second water table
+    // points partway into each one), so they're read whole, and only the entries which are
+    // actually matched to a tile sheet's colors are ever used
+    for (int i = 0; i < NUM_FG_PALETTES && waterValid; i++) {
+        uint addr = waterBank | (waterBase[0][ver] + i * WATER_PALETTE_SIZE);
+
+        palettes->water[i] = readColors(rom, addr, WATER_PALETTE_SIZE);
+    }
+
+    if (!fgValid) {
+        for (int i = 0; i < NUM_FG_PALETTES; i++) {
+            palettes->fg[0][i].clear();
+            palettes->fg[1][i].clear();
+        }
+    }
+    if (!waterValid) {
+        for (int i = 0; i < NUM_FG_PALETTES; i++)
+            palettes->water[i].clear();
+    }
+}
+
+int findPalette(const QVector<QRgb> &colors, const QVector<QRgb> *palettes, int numPalettes,
+                int *numMatches) {
+    int best = -1;
+    int bestMatches = PALETTE_MIN_MATCHES - 1;
+
+    for (int i = 0; i < numPalettes; i++) {
+        int matches = 0;
+
+        for (QRgb color: colors) {
+            for (QRgb palColor: palettes[i]) {
+                if (sameColor(color, palColor)) {
+                    matches++;
+                    break;
+                }
+            }
+        }
+
+        if (matches > bestMatches) {
+            best = i;
+            bestMatches = matches;
+        }
+    }
+
+    if (numMatches)
+        *numMatches = best >= 0 ? bestMatches : 0;
+
+    return best;
+}
+
+palettemap_t mapPalettes(const TileAtlas &tiles, const palettes_t &palettes, bool water) {
+    const QVector<QRgb>    &colors = tiles.colorTable();
+    const QVector<uint8_t> &bands  = tiles.colorBands();
+
+    palettemap_t map;
+    map.fg.fill(-1, colors.size());
+    map.water.fill(-1, colors.size());
+
+    for (int band = 0; band < tiles.numBands(); band++) {
+        QVector<QRgb> bandColors;
+        for (int i = 1; i < colors.size(); i++) {
+            if (bands[i] == band)
+                bandColors.append(colors[i]);
+        }
+
+        // each band is drawn with a single palette, so use whichever one it matches best
+        int fgMatches = 0, waterMatches = 0;
+        int fgRef    = findPalette(bandColors, palettes.fg[0], NUM_FG_PALETTES, &fgMatches);
+        int waterRef = water ? findPalette(bandColors, palettes.water, NUM_FG_PALETTES, &waterMatches)
+                             : -1;
+
+        const QVector<QRgb> *ref;
+        QVector<int> *pos;
+        if (waterRef >= 0 && waterMatches > fgMatches) {
+            ref = &palettes.water[waterRef];
+            pos = &map.water;
+        } else if (fgRef >= 0) {
+            ref = &palettes.fg[0][fgRef];
+            pos = &map.fg;
+        } else {
+            continue;
+        }
+
+        for (int i = 1; i < colors.size(); i++) {
+            if (bands[i] != band) continue;
+
+            for (int j = 0; j < ref->size(); j++) {
+                if (sameColor(colors[i], ref->at(j))) {
+                    (*pos)[i] = j;
+                    break;
+                }
+            }
+        }
+    }
+
+    return map;
+}
+
+QVector<QRgb> applyPalettes(const TileAtlas &tiles, const palettemap_t &map,
+                            const QVector<QRgb> &fg, const QVector<QRgb> &water) {
+    QVector<QRgb> colors(tiles.colorTable());
+    int size = qMin(colors.size(), qMin(map.fg.size(), map.water.size()));
+
+    for (int i = 0; i < size; i++) {
+        int fgPos    = map.fg[i];
+        int waterPos = map.water[i];
+
+        if (fgPos >= 0 && fgPos < fg.size() && qAlpha(fg[fgPos]))
+            colors[i] = fg[fgPos];
+        else if (waterPos >= 0 && waterPos < water.size() && qAlpha(water[waterPos]))
+            colors[i] = water[waterPos];
+    }
+
+    return colors;
+}
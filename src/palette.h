@@ -0,0 +1,53 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <cstdint>
+#include <QColor>
+#include <QVector>
+#include "romfile.h"
+#include "kirby.h"
+#include "tileatlas.h"
+
+/*
+  The foreground and water palettes which can be selected for each course,
+  as read from the ROM. (these are empty if no ROM with palettes is open)
+*/
+typedef struct {
+    // foreground palettes; [0] = daytime, [1] = nighttime
+    QVector<QRgb> fg[2][NUM_FG_PALETTES];
+    QVector<QRgb> water[NUM_FG_PALETTES];
+} palettes_t;
+
+/*
+  Where each color of a tile atlas comes from in the course palettes: its position in the
+  foreground or water palettes, or -1 to keep the atlas's own color.
+*/
+typedef struct {
+    QVector<int> fg, water;
+} palettemap_t;
+
+// convert a 15-bit SNES color to a regular one
+QRgb snesColor(uint16_t color);
+
+// read the palettes from the ROM
+// (they're left empty if they aren't where they're expected to be)
+void readPalettes(ROMFile &rom, palettes_t *palettes);
+
+// find which of a set of palettes the colors in a color table were taken from
+// (returns -1 if none of them are close enough)
+int  findPalette(const QVector<QRgb> &colors, const QVector<QRgb> *palettes, int numPalettes,
+                 int *numMatches = 0);
+
+// match each band of a tile atlas to the palette it was made with
+// (water palettes are only used if 'water' is true)
+palettemap_t mapPalettes(const TileAtlas &tiles, const palettes_t &palettes, bool water);
+// build the color table for a tile atlas using the selected foreground and water palettes
+QVector<QRgb> applyPalettes(const TileAtlas &tiles, const palettemap_t &map,
+                            const QVector<QRgb> &fg, const QVector<QRgb> &water);
+
+#endif // PALETTE_H
@@ -0,0 +1,331 @@
+/*
+  playfield.cpp
+
+  Contains the sparse tile map used to hold the isometric view of a level, both for saving
+  (chunks 5 through 9) and for rendering the preview window.
+
+  For the code which actually generates the isometric tile maps, see level.cpp.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include "playfield.h"
+#include "graphics.h"
+
+#include <algorithm>
+#include <climits>
+
+// how many extra columns to allocate when a row has to grow to the left
+// (rows are mostly filled in from right to left, one metatile at a time)
+#define ROW_GROW_SIZE 8
+
+Playfield::Playfield()
+    : fieldWidth(0), fieldHeight(0)
+{}
+
+void Playfield::clear(uint width, uint height) {
+    fieldWidth  = width;
+    fieldHeight = height;
+
+    rows.clear();
+    rows.resize(height);
+
+    for (row_t& row: rows) {
+        row.lo    = row.start = (int)width;
+        row.hi    = row.end   = -1;
+    }
+}
+
+uint16_t Playfield::at(uint layer, uint row, uint col) const {
+    if (row >= fieldHeight) return 0;
+
+    const row_t& thisRow = rows[row];
+    if ((int)col < thisRow.lo || (int)col > thisRow.hi) return 0;
+
+    return thisRow.tiles[layer][col - thisRow.lo];
+}
+
+uint16_t Playfield::owner(uint layer, uint row, uint col) const {
+    if (row >= fieldHeight) return 0;
+
+    const row_t& thisRow = rows[row];
+    if ((int)col < thisRow.lo || (int)col > thisRow.hi) return 0;
+
+    return thisRow.owners[layer][col - thisRow.lo];
+}
+
+void Playfield::set(uint layer, uint row, uint col, uint16_t tile, uint16_t owner) {
+    if (row >= fieldHeight || col >= fieldWidth) return;
+
+    row_t& thisRow = rows[row];
+    int c = (int)col;
+
+    // make room for this column if necessary
+    if (thisRow.hi < thisRow.lo) {
+        thisRow.lo = thisRow.hi = c;
+        for (int i = 0; i < 2; i++) {
+            thisRow.tiles[i].assign(1, 0);
+            thisRow.owners[i].assign(1, 0);
+        }
+
+    } else if (c < thisRow.lo) {
+        int newLo = qMax(0, qMin(c, thisRow.lo - ROW_GROW_SIZE));
+        for (int i = 0; i < 2; i++) {
+            thisRow.tiles[i].insert(thisRow.tiles[i].begin(), thisRow.lo - newLo, 0);
+            thisRow.owners[i].insert(thisRow.owners[i].begin(), thisRow.lo - newLo, 0);
+        }
+        thisRow.lo = newLo;
+
+    } else if (c > thisRow.hi) {
+        for (int i = 0; i < 2; i++) {
+            thisRow.tiles[i].resize(c - thisRow.lo + 1, 0);
+            thisRow.owners[i].resize(c - thisRow.lo + 1, 0);
+        }
+        thisRow.hi = c;
+    }
+
+    thisRow.tiles[layer][c - thisRow.lo]  = tile;
+    thisRow.owners[layer][c - thisRow.lo] = owner;
+
+    // update the visible range of the row
+    if (TILE(tile)) {
+        thisRow.start = qMin(thisRow.start, c);
+        thisRow.end   = qMax(thisRow.end, c);
+    }
+}
+
+/*
+  Returns true if a column has a visible tile on either layer.
+*/
+bool Playfield::visible(const row_t &row, int col) const {
+    return TILE(row.tiles[0][col - row.lo]) || TILE(row.tiles[1][col - row.lo]);
+}
+
+bool Playfield::rowEmpty(uint row) const {
+    return rowStart(row) >= fieldWidth;
+}
+
+/*
+  Returns the first visible column of a row, or the playfield width if the row is empty.
+  (A visible tile can be overwritten with an empty one, so the edges of the tracked range
+  are double-checked here, but the rest of the row never needs to be looked at.)
+*/
+uint Playfield::rowStart(uint row) const {
+    if (row >= fieldHeight) return fieldWidth;
+
+    const row_t& thisRow = rows[row];
+    int start = thisRow.start;
+
+    while (start <= thisRow.end && !visible(thisRow, start))
+        start++;
+
+    return start <= thisRow.end ? start : fieldWidth;
+}
+
+/*
+  Returns the last visible column of a row, or the playfield width if the row is empty.
+*/
+uint Playfield::rowEnd(uint row) const {
+    if (row >= fieldHeight) return fieldWidth;
+
+    const row_t& thisRow = rows[row];
+    int end = thisRow.end;
+
+    while (end >= thisRow.start && !visible(thisRow, end))
+        end--;
+
+    return end >= thisRow.start ? end : fieldWidth;
+}
+
+const uint16_t* Playfield::rowData(uint layer, uint row) const {
+    if (rowEmpty(row)) return 0;
+
+    const row_t& thisRow = rows[row];
+    return &thisRow.tiles[layer][rowStart(row) - thisRow.lo];
+}
+
+bool Playfield::operator==(const Playfield &other) const {
+    if (fieldWidth != other.fieldWidth || fieldHeight != other.fieldHeight)
+        return false;
+
+    for (uint row = 0; row < fieldHeight; row++) {
+        int lo = qMin(rows[row].lo, other.rows[row].lo);
+        int hi = qMax(rows[row].hi, other.rows[row].hi);
+
+        for (int col = lo; col <= hi; col++)
+            if (at(0, row, col) != other.at(0, row, col)
+                    || at(1, row, col) != other.at(1, row, col))
+                return false;
+    }
+
+    return true;
+}
+
+bool Playfield::diffRow(const Playfield &other, uint row, uint *first, uint *last) const {
+    int lo = INT_MAX, hi = -1;
+
+    // only the columns which have been written to in either playfield can differ
+    if (row < fieldHeight) {
+        lo = qMin(lo, rows[row].lo);
+        hi = qMax(hi, rows[row].hi);
+    }
+    if (row < other.fieldHeight) {
+        lo = qMin(lo, other.rows[row].lo);
+        hi = qMax(hi, other.rows[row].hi);
+    }
+
+    while (lo <= hi && at(0, row, lo) == other.at(0, row, lo)
+                    && at(1, row, lo) == other.at(1, row, lo))
+        lo++;
+    while (hi >= lo && at(0, row, hi) == other.at(0, row, hi)
+                    && at(1, row, hi) == other.at(1, row, hi))
+        hi--;
+
+    if (lo > hi) return false;
+
+    if (first) *first = lo;
+    if (last)  *last  = hi;
+    return true;
+}
+
+/*
+  Packs the visible part of each row into the tile data buffers for chunks 8 and 9.
+
+  Since each row has its own offset into the tile data (and the same offset is used for both
+  layers), a row which is identical to or part of an already packed row can just reuse it,
+  and a row which begins with the same tiles that the packed data ends with only needs the
+  rest of it added.
+*/
+uint Playfield::pack(uint16_t *rowStarts, uint16_t *rowEnds, uint16_t *rowOffsets,
+                     uint16_t *layer1, uint16_t *layer2,
+                     uint maxSize, uint *packedSize) const {
+    std::vector<uint>     order;
+    std::vector<uint32_t> data;
+
+    for (uint row = 0; row < fieldHeight; row++)
+        if (!rowEmpty(row))
+            order.push_back(row);
+
+    // pack the longest rows first, so the shorter ones have more chances to fit inside them
+    std::stable_sort(order.begin(), order.end(), [this](uint a, uint b) {
+        return rowEnd(a) - rowStart(a) > rowEnd(b) - rowStart(b);
+    });
+
+    uint fullSize = packRows(order, rowOffsets, data, UINT_MAX);
+
+    // if everything doesn't fit anyway, then pack the rows from top to bottom instead
+    // so that only the bottom rows get left out
+    if (fullSize > maxSize) {
+        std::sort(order.begin(), order.end());
+        packRows(order, rowOffsets, data, maxSize);
+    }
+
+    for (uint row = 0; row < fieldHeight; row++) {
+        if (rowEmpty(row) || rowOffsets[row] == 0xFFFF) {
+            rowStarts[row]  = 0xFFFF;
+            rowEnds[row]    = 0xFFFF;
+            rowOffsets[row] = 0xFFFF;
+        } else {
+            rowStarts[row]  = rowStart(row);
+            rowEnds[row]    = rowEnd(row);
+        }
+    }
+
+    for (uint i = 0; i < data.size(); i++) {
+        layer1[i] = data[i] >> 16;
+        layer2[i] = data[i] & 0xFFFF;
+    }
+
+    if (packedSize)
+        *packedSize = data.size();
+
+    return fullSize;
+}
+
+/*
+  Packs rows (in the given order) into a single buffer of tiles, with the tiles from both layers
+  combined so that rows can only share data where both layers are the same.
+  Stops at the first row which would make the buffer larger than maxSize, leaving out
+  that row and the rest of them.
+  Returns the total size of the buffer.
+*/
+uint Playfield::packRows(const std::vector<uint> &order, uint16_t *rowOffsets,
+                         std::vector<uint32_t> &data, uint maxSize) const {
+    std::vector<uint32_t> thisRow;
+    std::vector<uint>     fail;
+
+    data.clear();
+    for (uint row = 0; row < fieldHeight; row++)
+        rowOffsets[row] = 0xFFFF;
+
+    for (uint row: order) {
+        uint len = rowEnd(row) - rowStart(row) + 1;
+        const uint16_t *tiles1 = rowData(0, row);
+        const uint16_t *tiles2 = rowData(1, row);
+
+        thisRow.resize(len);
+        for (uint i = 0; i < len; i++)
+            thisRow[i] = (uint32_t)tiles1[i] << 16 | tiles2[i];
+
+        // build the KMP failure table for this row
+        fail.assign(len, 0);
+        for (uint i = 1, k = 0; i < len; i++) {
+            while (k && thisRow[i] != thisRow[k])
+                k = fail[k - 1];
+            if (thisRow[i] == thisRow[k])
+                k++;
+            fail[i] = k;
+        }
+
+        // look for the row in the existing data.
+        // if it isn't found, then 'matched' ends up as the number of tiles at the end of
+        // the existing data which match the start of this row
+        uint matched = 0;
+        int  found = -1;
+        for (uint i = 0; i < data.size(); i++) {
+            while (matched && data[i] != thisRow[matched])
+                matched = fail[matched - 1];
+            if (data[i] == thisRow[matched])
+                matched++;
+            if (matched == len) {
+                found = i + 1 - len;
+                break;
+            }
+        }
+
+        if (found >= 0) {
+            rowOffsets[row] = found;
+        } else {
+            uint offset = data.size() - matched;
+            // out of room, so leave out this row and every one after it
+            if (offset + len > maxSize)
+                break;
+
+            data.insert(data.end(), thisRow.begin() + matched, thisRow.end());
+            rowOffsets[row] = offset;
+        }
+    }
+
+    return data.size();
+}
+
+size_t Playfield::size() const {
+    size_t total = 0;
+
+    for (uint row = 0; row < fieldHeight; row++)
+        if (!rowEmpty(row))
+            total += rowEnd(row) - rowStart(row) + 1;
+
+    return total * 2;
+}
+
+size_t Playfield::memoryUsage() const {
+    size_t total = sizeof(Playfield) + rows.capacity() * sizeof(row_t);
+
+    for (const row_t& row: rows)
+        total += (row.tiles[0].capacity()  + row.tiles[1].capacity()
+                + row.owners[0].capacity() + row.owners[1].capacity()) * sizeof(uint16_t);
+
+    return total;
+}
@@ -0,0 +1,87 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PLAYFIELD_H
+#define PLAYFIELD_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include <QtGlobal>
+
+/*
+  Sparse storage for the two layers of the isometric 8x8 tile map.
+
+  Instead of a full MAX_FIELD_HEIGHT x MAX_FIELD_WIDTH grid, each row only stores
+  the columns that have actually been written to, and keeps track of the first and
+  last visible (nonzero) tile on either layer as tiles are written. This is the same
+  information stored in chunks 5 and 6, so the tile map can be written out without
+  having to rescan every row.
+
+  Each tile also remembers which 2D map tile it was drawn for (its "owner"), so that a
+  point in the isometric view can be traced back to the 2D map without searching.
+*/
+class Playfield {
+public:
+    Playfield();
+
+    // erase all tile data and set the playfield size (in 8x8 tiles)
+    void     clear(uint width, uint height);
+
+    uint     width() const  { return fieldWidth; }
+    uint     height() const { return fieldHeight; }
+
+    uint16_t at(uint layer, uint row, uint col) const;
+    void     set(uint layer, uint row, uint col, uint16_t tile, uint16_t owner = 0);
+    // which 2D map tile a tile was drawn for (y * MAX_2D_SIZE + x + 1, or 0 for none)
+    uint16_t owner(uint layer, uint row, uint col) const;
+
+    // visible span of a row (first and last column with a nonzero tile on either layer)
+    bool     rowEmpty(uint row) const;
+    uint     rowStart(uint row) const;
+    uint     rowEnd(uint row) const;
+    // tile data for one layer of a row, beginning at rowStart()
+    const uint16_t* rowData(uint layer, uint row) const;
+
+    // true if both playfields have exactly the same size and contents
+    bool     operator==(const Playfield &other) const;
+    bool     operator!=(const Playfield &other) const { return !(*this == other); }
+    // find the first and last column of a row which differ between two playfields.
+    // returns false if the row is the same in both
+    bool     diffRow(const Playfield &other, uint row, uint *first, uint *last) const;
+
+    // pack the visible tile data into the format used by chunks 5 through 9,
+    // letting identical or overlapping rows share the same tile data.
+    // returns the size (in tiles) needed to fit every row, which may be more than maxSize.
+    // rows which did not fit are marked empty.
+    uint     pack(uint16_t *rowStarts, uint16_t *rowEnds, uint16_t *rowOffsets,
+                  uint16_t *layer1, uint16_t *layer2,
+                  uint maxSize, uint *packedSize) const;
+
+    // total size of the visible tile data for one layer, in bytes
+    size_t   size() const;
+    // approximate amount of memory used by the tile data
+    size_t   memoryUsage() const;
+
+private:
+    struct row_t {
+        // range of columns which have been written to (and have storage)
+        int lo, hi;
+        // range of columns which have had a nonzero tile written to them
+        int start, end;
+        std::vector<uint16_t> tiles[2];
+        std::vector<uint16_t> owners[2];
+    };
+
+    uint fieldWidth, fieldHeight;
+    std::vector<row_t> rows;
+
+    bool visible(const row_t &row, int col) const;
+    uint packRows(const std::vector<uint> &order, uint16_t *rowOffsets,
+                  std::vector<uint32_t> &data, uint maxSize) const;
+};
+
+#endif // PLAYFIELD_H
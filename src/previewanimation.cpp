@@ -0,0 +1,203 @@
+/*
+  previewanimation.cpp
+
+  Contains the palette cycling animation used by the preview for water, conveyor belts
+  and rotating spaces. (This isn't the game's actual animation, just something to show
+  which way things are moving.)
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <cstring>
+#include <cstdlib>
+
+#include "previewanimation.h"
+#include "graphics.h"
+#include "metatile.h"
+
+// how many frames each step of each animation lasts (at 60 frames per second)
+static const int animSpeed[NUM_ANIM_TYPES] = {8, 4, 6};
+// how much each step of each animation brightens the tile's colors
+static const int animLight[NUM_ANIM_TYPES][ANIM_PHASES] = {
+    {0, 16, 32, 16},
+    {0,  0, 40,  0},
+    {0,  0, 40,  0}
+};
+
+// direction each conveyor belt moves in, in cells of the tile map (belts to beltWestDown)
+static const int beltDirs[][2] = {
+    {-2,  1}, { 2,  1}, { 2, -1}, {-2, -1}, // south, east, north, west
+    { 2, -1}, {-2,  1}, {-2, -1}, { 2,  1}, // north up, south down, west up, east down
+    {-2,  1}, { 2, -1}, { 2,  1}, {-2, -1}  // south up, north down, east up, west down
+};
+
+PreviewAnimation::PreviewAnimation()
+    : width(0), height(0)
+{
+    clear();
+}
+
+void PreviewAnimation::clear() {
+    width = height = 0;
+    cellAnim.clear();
+    animSpans.clear();
+
+    memset(slots, 0, sizeof(slots));
+    slotAnim.clear();
+    slotColor.clear();
+}
+
+QVector<QRect> PreviewAnimation::setLevel(const leveldata_t *level, int width, int height) {
+    QVector<int8_t> newAnim(width * height, -1);
+
+    int mapHeight = levelHeight(level);
+    int mapLength = level->header.length;
+
+    for (int y = 0; y < mapLength; y++) {
+        for (int x = 0; x < level->header.width; x++) {
+            const maptile_t &tile = level->tiles[y][x];
+            int obs = tile.obstacle;
+            int type;
+
+            if (obs >= stuff::water && obs < stuff::endWater)
+                type = animWater;
+            else if (obs >= stuff::belts && obs <= stuff::beltWestDown)
+                type = animBelt;
+            else if (obs >= stuff::rotate && obs < stuff::endRotateOpposite)
+                type = animRotate;
+            else
+                continue;
+
+            // center of the top of the tile (see PreviewWindow::centerOn)
+            int centerX = (TILE_SIZE / 2) * (x + mapLength - y);
+            int centerY = (TILE_SIZE / 4) * (mapHeight + x + y - tile.height + 1);
+            if (tile.geometry >= stuff::slopes)
+                centerY += TILE_SIZE / 8;
+
+            // mark each cell whose center is inside the top of the tile
+            for (int cy = centerY - TILE_SIZE / 4; cy < centerY + TILE_SIZE / 4; cy += ISO_TILE_SIZE) {
+                for (int cx = centerX - TILE_SIZE / 2; cx < centerX + TILE_SIZE / 2; cx += ISO_TILE_SIZE) {
+                    int dx = cx + ISO_TILE_SIZE / 2 - centerX;
+                    int dy = cy + ISO_TILE_SIZE / 2 - centerY;
+                    if (abs(dx) + 2 * abs(dy) >= TILE_SIZE / 2) continue;
+
+                    int col = cx / ISO_TILE_SIZE;
+                    int row = cy / ISO_TILE_SIZE;
+                    if (cx < 0 || cy < 0 || col >= width || row >= height) continue;
+
+                    int phase;
+                    if (type == animWater) {
+                        // diagonal waves
+                        phase = (col / 2) + row;
+                    } else if (type == animBelt) {
+                        // stripes moving along the belt
+                        const int *dir = beltDirs[obs - stuff::belts];
+                        phase = -(col * dir[0] + row * dir[1]);
+                    } else {
+                        // one quarter of the tile at a time, going around
+                        // (odd types turn counterclockwise)
+                        int quarter = dx >= 0 ? (dy < 0 ? 0 : 1) : (dy >= 0 ? 2 : 3);
+                        phase = (obs & 1) ? quarter : -quarter;
+                    }
+
+                    newAnim[row * width + col] = type * ANIM_PHASES + (phase & (ANIM_PHASES - 1));
+                }
+            }
+        }
+    }
+
+    // find what changed and where the animated cells are now
+    QVector<QRect> changed;
+    bool sameSize = width == this->width && height == this->height;
+
+    animSpans.clear();
+    for (int row = 0; row < height; row++) {
+        const int8_t *cells = newAnim.constData() + row * width;
+        const int8_t *old   = sameSize ? cellAnim.constData() + row * width : NULL;
+
+        int first = -1, last = -1;
+        for (int col = 0; col < width; col++) {
+            if (old ? cells[col] != old[col] : cells[col] >= 0) {
+                if (first < 0) first = col;
+                last = col;
+            }
+        }
+        if (first >= 0)
+            changed.append(QRect(first, row, last - first + 1, 1));
+
+        for (int col = 0; col < width; col++) {
+            if (cells[col] < 0) continue;
+
+            int start = col;
+            while (col < width && cells[col] >= 0) col++;
+            animSpans.append(QRect(start, row, col - start, 1));
+        }
+    }
+
+    this->width  = width;
+    this->height = height;
+    cellAnim = newAnim;
+
+    return changed;
+}
+
+uint8_t PreviewAnimation::slot(int anim, uint8_t color) {
+    uint8_t &s = slots[anim][color];
+
+    if (!s) {
+        // out of colors, so this one won't be animated
+        if (ANIM_COLOR_BASE + slotColor.size() > 255)
+            return color;
+
+        s = ANIM_COLOR_BASE + slotColor.size();
+        slotAnim.append(anim);
+        slotColor.append(color);
+    }
+
+    return s;
+}
+
+void PreviewAnimation::remap(QImage &image, const QPoint &origin, const QRect &cells) {
+    QRect area = cells
+            & QRect(origin, QSize(image.width() / ISO_TILE_SIZE, image.height() / ISO_TILE_SIZE))
+            & QRect(0, 0, width, height);
+
+    for (int row = area.top(); row <= area.bottom(); row++) {
+        for (int col = area.left(); col <= area.right(); col++) {
+            int anim = cellAnim[row * width + col];
+            if (anim < 0) continue;
+
+            for (int i = 0; i < ISO_TILE_SIZE; i++) {
+                uint8_t *pixels = image.scanLine((row - origin.y()) * ISO_TILE_SIZE + i)
+                                + (col - origin.x()) * ISO_TILE_SIZE;
+
+                for (int j = 0; j < ISO_TILE_SIZE; j++) {
+                    if (pixels[j] && pixels[j] < ANIM_COLOR_BASE)
+                        pixels[j] = slot(anim, pixels[j]);
+                }
+            }
+        }
+    }
+}
+
+QVector<QRgb> PreviewAnimation::colorTable(const QVector<QRgb> &colors, int frame) const {
+    if (slotColor.isEmpty())
+        return colors;
+
+    QVector<QRgb> table(colors.mid(0, ANIM_COLOR_BASE));
+    table.resize(ANIM_COLOR_BASE);
+
+    for (int i = 0; i < slotColor.size(); i++) {
+        int type  = slotAnim[i] / ANIM_PHASES;
+        int phase = slotAnim[i] % ANIM_PHASES;
+        int light = animLight[type][(frame / animSpeed[type] + phase) % ANIM_PHASES];
+
+        QRgb color = table[slotColor[i]];
+        table.append(qRgb(qMin(255, qRed(color)   + light),
+                          qMin(255, qGreen(color) + light),
+                          qMin(255, qBlue(color)  + light)));
+    }
+
+    return table;
+}
@@ -0,0 +1,73 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PREVIEWANIMATION_H
+#define PREVIEWANIMATION_H
+
+#include <cstdint>
+#include <QImage>
+#include <QVector>
+#include <QRect>
+#include "level.h"
+#include "tileatlas.h"
+
+// kinds of animated 2D map tiles
+enum {
+    animWater,
+    animBelt,
+    animRotate,
+    NUM_ANIM_TYPES
+};
+
+// number of steps in each animation
+#define ANIM_PHASES 4
+// the first color table entry used for animated colors
+// (the tile sheets' own colors come before this)
+#define ANIM_COLOR_BASE TILE_ATLAS_COLORS
+
+/*
+  Palette cycling animation for water, conveyor belts and rotating spaces in the preview.
+
+  Each cell of the tile map covered by an animated 2D map tile is assigned a type and phase
+  of animation; once a cell is drawn, its pixels are switched over to a separate set of
+  color table entries for that type and phase. Animating the preview then only means
+  changing those color table entries and repainting the animated cells, without drawing
+  any tiles.
+*/
+class PreviewAnimation {
+public:
+    PreviewAnimation();
+
+    // find which cells of a level's tile map are animated,
+    // and return the ones that changed since last time (as spans of rows)
+    QVector<QRect> setLevel(const leveldata_t *level, int width, int height);
+    void           clear();
+
+    // all of the animated cells, as spans of rows
+    const QVector<QRect>& spans() const { return animSpans; }
+
+    // switch the animated cells in part of an image (whose top left is at cell 'origin')
+    // over to the animated colors
+    void           remap(QImage &image, const QPoint &origin, const QRect &cells);
+
+    // color table for one frame of the animation, based on the tile sheet's colors
+    QVector<QRgb>  colorTable(const QVector<QRgb> &colors, int frame) const;
+    int            numColors() const { return slotColor.size(); }
+
+private:
+    int width, height;
+    // animation type and phase of each cell (or -1 if it isn't animated)
+    QVector<int8_t> cellAnim;
+    QVector<QRect>  animSpans;
+
+    // which animated color each tile sheet color becomes for each type and phase of animation
+    // (0 = none yet)
+    uint8_t              slots[NUM_ANIM_TYPES * ANIM_PHASES][ANIM_COLOR_BASE];
+    QVector<uint8_t>     slotAnim, slotColor;
+
+    uint8_t slot(int anim, uint8_t color);
+};
+
+#endif // PREVIEWANIMATION_H
@@ -0,0 +1,79 @@
+/*
+  previewcache.cpp
+
+  Contains the cache of tile maps and rendered images used by the preview window, which lets
+  it switch to a level it's seen (or prefetched) recently without making its tile map again.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include "previewcache.h"
+
+// default memory limit (see PreviewWindow::setCacheSize)
+#define PREVIEW_CACHE_MAX (64 * 1024 * 1024)
+
+PreviewCache::PreviewCache()
+    : usedMemory(0),
+      maxSize(PREVIEW_CACHE_MAX)
+{}
+
+PreviewCache::~PreviewCache() {
+    clear();
+}
+
+size_t PreviewCache::previewSize(const preview_t *preview) {
+    return sizeof(preview_t) + preview->playfield.memoryUsage() + preview->image.sizeInBytes();
+}
+
+const preview_t* PreviewCache::find(const QByteArray &key) {
+    preview_t *preview = previews.value(key, NULL);
+
+    if (preview) {
+        // move it to the end of the list
+        used.removeOne(key);
+        used.append(key);
+    }
+
+    return preview;
+}
+
+void PreviewCache::insert(const QByteArray &key, preview_t *preview) {
+    preview_t *old = previews.value(key, NULL);
+    if (old) {
+        usedMemory -= previewSize(old);
+        used.removeOne(key);
+        delete old;
+    }
+
+    previews.insert(key, preview);
+    used.append(key);
+    usedMemory += previewSize(preview);
+
+    trim();
+}
+
+void PreviewCache::clear() {
+    qDeleteAll(previews);
+    previews.clear();
+    used.clear();
+    usedMemory = 0;
+}
+
+void PreviewCache::setMaxSize(size_t bytes) {
+    maxSize = bytes;
+    trim();
+}
+
+/*
+  Throws away the least recently used previews until they fit in the memory limit.
+  (The newest one is always kept, however big it is.)
+*/
+void PreviewCache::trim() {
+    while (usedMemory > maxSize && used.size() > 1) {
+        preview_t *preview = previews.take(used.takeFirst());
+
+        usedMemory -= previewSize(preview);
+        delete preview;
+    }
+}
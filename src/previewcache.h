@@ -0,0 +1,58 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PREVIEWCACHE_H
+#define PREVIEWCACHE_H
+
+#include <cstddef>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QImage>
+#include "playfield.h"
+#include "tileatlas.h"
+
+/*
+  A level's tile map, and (optionally) the whole tile map already drawn.
+*/
+typedef struct {
+    Playfield        playfield;
+    uint16_t         fieldWidth, fieldHeight;
+    // which tiles the image was drawn with (or null if it hasn't been drawn)
+    const TileAtlas *tiles;
+    QImage           image;
+} preview_t;
+
+/*
+  Tile maps (and rendered images) of recently seen levels, by level hash (see levelHash()),
+  so going back to a level or undoing an edit doesn't have to make them again.
+  The least recently used ones are thrown away once they use too much memory.
+*/
+class PreviewCache {
+public:
+    PreviewCache();
+    ~PreviewCache();
+
+    // find a level's preview (or null) and mark it as recently used.
+    // the pointer is only good until the next insert() or clear()
+    const preview_t* find(const QByteArray &key);
+    // add a level's preview (which the cache then owns), replacing any older one
+    void   insert(const QByteArray &key, preview_t *preview);
+    void   clear();
+
+    void   setMaxSize(size_t bytes);
+    size_t memoryUsage() const { return usedMemory; }
+
+private:
+    QHash<QByteArray, preview_t*> previews;
+    // from least to most recently used
+    QList<QByteArray> used;
+    size_t usedMemory, maxSize;
+
+    static size_t previewSize(const preview_t *preview);
+    void   trim();
+};
+
+#endif // PREVIEWCACHE_H
@@ -0,0 +1,426 @@
+/*
+  previewrenderer.cpp
+
+  Contains the renderer for levels' isometric views, which is used by the preview scene
+  (and anything else that needs a picture of a level.)
+
+  For the code which actually generates the isometric tile maps, see level.cpp.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include <QPainter>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "previewrenderer.h"
+#include "graphicscache.h"
+#include "palette.h"
+#include "graphics.h"
+#include "metatile.h"
+#include "obstaclesprites.h"
+
+// number of rows of 8x8 tiles drawn at a time by each thread
+#define RENDER_BAND_ROWS 16
+
+PreviewRenderer::PreviewRenderer()
+    : palettes(NULL),
+      fgPalette(0), waterPalette(0),
+      night(false)
+{
+    // set up sprite images
+    for (int i = 0; i < NUM_SPRITE_SHEETS; i++) {
+        if (spriteFiles3D[i])
+            spriteSheets[i] = GraphicsCache::image(spriteFiles3D[i]);
+    }
+
+    // set up the 3d tiles
+    setTiles(NULL, NULL);
+}
+
+/*
+  Sets the tile graphics used for land and water levels.
+  If either is null, the bundled tile sheet is used instead.
+*/
+void PreviewRenderer::setTiles(const TileAtlas *land, const TileAtlas *water) {
+    landTiles  = land  ? land  : &GraphicsCache::atlas(":images/3dtiles.png");
+    waterTiles = water ? water : &GraphicsCache::atlas(":images/3dtiles-water.png");
+
+    // the new tiles' colors need to be matched to the palettes again
+    mapColors();
+    setPalette(palettes, fgPalette, waterPalette, night);
+}
+
+/*
+  Finds out which palette each band of the tile sheets was made with.
+  This only has to be done when the tiles or the palettes themselves change.
+*/
+void PreviewRenderer::mapColors() {
+    if (palettes) {
+        landMap  = mapPalettes(*landTiles,  *palettes, false);
+        waterMap = mapPalettes(*waterTiles, *palettes, true);
+    } else {
+        landMap = waterMap = palettemap_t();
+    }
+}
+
+/*
+  Sets the colors the tiles are drawn with. Since the tiles are drawn as color indices,
+  this only has to rebuild the color tables and not redraw anything.
+  If no palettes are given (i.e. none were loaded from the ROM), the tile sheets' own
+  colors are used.
+*/
+void PreviewRenderer::setPalette(const palettes_t *palettes, int fg, int water, bool night) {
+    if (palettes != this->palettes) {
+        this->palettes = palettes;
+        mapColors();
+    }
+    fgPalette      = fg;
+    waterPalette   = water;
+    this->night    = night;
+
+    QVector<QRgb> fgPal, waterPal;
+    if (palettes && fg >= 0 && fg < NUM_FG_PALETTES)
+        fgPal = palettes->fg[night][fg];
+    if (palettes && water >= 0 && water < NUM_FG_PALETTES)
+        waterPal = palettes->water[water];
+
+    // each band of the tile sheets takes its colors straight from the palette it was matched to
+    landColors  = applyPalettes(*landTiles,  landMap,  fgPal, waterPal);
+    waterColors = applyPalettes(*waterTiles, waterMap, fgPal, waterPal);
+}
+
+const QVector<QRgb>& PreviewRenderer::colorTable(const leveldata_t *level) const {
+    return waterLevel(level) ? waterColors : landColors;
+}
+
+const TileAtlas& PreviewRenderer::tilesFor(const leveldata_t *level) const {
+    return waterLevel(level) ? *waterTiles : *landTiles;
+}
+
+QImage PreviewRenderer::render(const Playfield &playfield, const leveldata_t *level,
+                               bool sprites, int numThreads) const {
+    int width  = qMin(MAX_FIELD_WIDTH,  (int)level->header.fieldWidth);
+    int height = qMin(MAX_FIELD_HEIGHT, (int)level->header.fieldHeight);
+
+    QImage image(width * ISO_TILE_SIZE, height * ISO_TILE_SIZE, QImage::Format_Indexed8);
+    if (image.isNull())
+        return image;
+
+    image.setColorTable(colorTable(level));
+
+    // no level area = don't render anything
+    bool empty = level->header.length + level->header.width == 0;
+    if (empty)
+        image.fill(0);
+    else
+        drawTilesParallel(image, playfield, tilesFor(level), 0, height, numThreads);
+
+    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    // the sprites get drawn after all of the tiles are done
+    if (sprites && !empty) {
+        QPainter painter(&image);
+        drawSprites(painter, this->sprites(level));
+    }
+
+    return image;
+}
+
+/*
+  Draws one row of a tile over what's already in the image.
+  Since color 0 is the only transparent one, this only has to pick between the
+  tile's pixel and the existing one, instead of doing any actual blending.
+*/
+static inline void drawTileRow(uint8_t *dest, const uint8_t *src) {
+#ifdef __SSE2__
+    // (one row of a tile is 8 pixels = 8 bytes)
+    __m128i pixels = _mm_loadl_epi64((const __m128i*)src);
+    __m128i below  = _mm_loadl_epi64((const __m128i*)dest);
+    // all ones where the tile's pixel is transparent
+    __m128i mask   = _mm_cmpeq_epi8(pixels, _mm_setzero_si128());
+
+    _mm_storel_epi64((__m128i*)dest,
+                     _mm_or_si128(_mm_and_si128(mask, below),
+                                  _mm_andnot_si128(mask, pixels)));
+#else
+    for (int i = 0; i < ISO_TILE_SIZE; i++) {
+        if (src[i])
+            dest[i] = src[i];
+    }
+#endif
+}
+
+/*
+  Draws columns [firstCol, endCol) of one row of the tile map, given the lines of pixels
+  that row covers in the image (starting at column originCol).
+*/
+static void drawRowCells(uint8_t **lines, uint originCol,
+                         const Playfield &playfield, const TileAtlas &tiles,
+                         uint row, uint firstCol, uint endCol) {
+    int stride = tiles.stride();
+
+    // start with blank cells
+    if (endCol <= firstCol) return;
+    for (int i = 0; i < ISO_TILE_SIZE; i++) {
+        memset(lines[i] + (firstCol - originCol) * ISO_TILE_SIZE, 0,
+               (endCol - firstCol) * ISO_TILE_SIZE);
+    }
+
+    // only the visible part of each row needs to be drawn
+    if (playfield.rowEmpty(row)) return;
+
+    uint rowStart = playfield.rowStart(row);
+    uint start    = qMax(rowStart, firstCol);
+    uint end      = qMin(playfield.rowEnd(row) + 1, endCol);
+    const uint16_t *layer1 = playfield.rowData(0, row);
+    const uint16_t *layer2 = playfield.rowData(1, row);
+
+    for (uint w = start; w < end; w++) {
+        uint16_t tile1 = layer1[w - rowStart];
+        uint16_t tile2 = layer2[w - rowStart];
+
+        // if layer 1 has priority, draw layer 2 first
+        uint16_t lower = (tile1 & PRI) ? tile2 : tile1;
+        uint16_t upper = (tile1 & PRI) ? tile1 : tile2;
+
+        const uint8_t *lowerPixels = TILE(lower) ? tiles.tilePixels(lower) : 0;
+        const uint8_t *upperPixels = TILE(upper) ? tiles.tilePixels(upper) : 0;
+
+        // the cell is blank to begin with, so the lower tile can just be copied
+        for (int i = 0; i < ISO_TILE_SIZE; i++) {
+            uint8_t *dest = lines[i] + (w - originCol) * ISO_TILE_SIZE;
+
+            if (lowerPixels)
+                memcpy(dest, lowerPixels + i * stride, ISO_TILE_SIZE);
+            if (upperPixels)
+                drawTileRow(dest, upperPixels + i * stride);
+        }
+    }
+}
+
+/*
+  Draws rows [firstRow, endRow) of the tile map into an image's pixel data.
+  This only touches the pixels belonging to those rows, so different rows can be drawn
+  on different threads at the same time.
+*/
+static void drawTileRows(uchar *bits, int bytesPerLine, uint imageWidth, uint imageHeight,
+                         const Playfield &playfield, const TileAtlas &tiles,
+                         uint firstRow, uint endRow) {
+    uint width = imageWidth / ISO_TILE_SIZE;
+
+    endRow = qMin(endRow, imageHeight / ISO_TILE_SIZE);
+
+    for (uint h = firstRow; h < endRow; h++) {
+        uint8_t *lines[ISO_TILE_SIZE];
+
+        for (int i = 0; i < ISO_TILE_SIZE; i++)
+            lines[i] = bits + (h * ISO_TILE_SIZE + i) * bytesPerLine;
+
+        drawRowCells(lines, 0, playfield, tiles, h, 0, width);
+    }
+}
+
+void PreviewRenderer::drawTiles(QImage &image, const Playfield &playfield, const TileAtlas &tiles,
+                                uint firstRow, uint endRow) {
+    drawTileRows(image.bits(), image.bytesPerLine(), image.width(), image.height(),
+                 playfield, tiles, firstRow, endRow);
+}
+
+void PreviewRenderer::drawCells(QImage &image, const Playfield &playfield, const TileAtlas &tiles,
+                                uint row, uint firstCol, uint endCol) const {
+    if (row >= (uint)image.height() / ISO_TILE_SIZE) return;
+    endCol = qMin(endCol, (uint)image.width() / ISO_TILE_SIZE);
+
+    uint8_t *lines[ISO_TILE_SIZE];
+    for (int i = 0; i < ISO_TILE_SIZE; i++)
+        lines[i] = image.scanLine(row * ISO_TILE_SIZE + i);
+
+    drawRowCells(lines, 0, playfield, tiles, row, firstCol, endCol);
+}
+
+void PreviewRenderer::drawRegion(QImage &image, const QPoint &origin,
+                                 const Playfield &playfield, const TileAtlas &tiles,
+                                 const QRect &cells) const {
+    uint firstRow = qMax(cells.top(),  origin.y());
+    uint firstCol = qMax(cells.left(), origin.x());
+    uint endRow   = qMin(cells.bottom() + 1, origin.y() + image.height() / ISO_TILE_SIZE);
+    uint endCol   = qMin(cells.right()  + 1, origin.x() + image.width()  / ISO_TILE_SIZE);
+
+    for (uint h = firstRow; h < endRow; h++) {
+        uint8_t *lines[ISO_TILE_SIZE];
+
+        for (int i = 0; i < ISO_TILE_SIZE; i++)
+            lines[i] = image.scanLine((h - origin.y()) * ISO_TILE_SIZE + i);
+
+        drawRowCells(lines, origin.x(), playfield, tiles, h, firstCol, endCol);
+    }
+}
+
+/*
+  Finds the 2D map tile drawn at a pixel by looking at the (at most two) tiles drawn in that
+  cell, in the same order drawRowCells draws them, and taking the owner of whichever one
+  actually has a visible pixel there.
+*/
+int PreviewRenderer::tileAt(const Playfield &playfield, const TileAtlas &tiles,
+                            const QPoint &pos) const {
+    if (pos.x() < 0 || pos.y() < 0) return -1;
+
+    uint row = pos.y() / ISO_TILE_SIZE;
+    uint col = pos.x() / ISO_TILE_SIZE;
+
+    // if layer 1 has priority, it's the upper one
+    uint upper = (playfield.at(0, row, col) & PRI) ? 0 : 1;
+
+    for (uint layer: {upper, upper ^ 1}) {
+        uint16_t tile = playfield.at(layer, row, col);
+        if (!TILE(tile)) continue;
+
+        const uint8_t *pixels = tiles.tilePixels(tile);
+        if (!pixels) continue;
+
+        if (pixels[(pos.y() % ISO_TILE_SIZE) * tiles.stride() + (pos.x() % ISO_TILE_SIZE)])
+            return playfield.owner(layer, row, col) - 1;
+    }
+
+    return -1;
+}
+
+/*
+ * Worker object for drawing the tile map on several threads.
+ * Each worker keeps taking the next band of rows until there are none left.
+ */
+class RenderWorker : public QRunnable {
+
+public:
+    RenderWorker(uchar *bits, int bytesPerLine, uint imageWidth, uint imageHeight,
+                 const Playfield *playfield, const TileAtlas *tiles, uint startRow, uint endRow,
+                 QAtomicInt *nextBand, QSemaphore *done)
+        : bits(bits), bytesPerLine(bytesPerLine), imageWidth(imageWidth), imageHeight(imageHeight),
+          playfield(playfield), tiles(tiles), startRow(startRow), endRow(endRow),
+          nextBand(nextBand), done(done) {}
+
+    void run() {
+        forever {
+            uint firstRow = startRow + nextBand->fetchAndAddRelaxed(1) * RENDER_BAND_ROWS;
+            if (firstRow >= endRow) break;
+
+            drawTileRows(bits, bytesPerLine, imageWidth, imageHeight, *playfield, *tiles,
+                         firstRow, qMin(firstRow + RENDER_BAND_ROWS, endRow));
+        }
+
+        done->release();
+    }
+
+protected:
+    uchar *bits;
+    int bytesPerLine;
+    uint imageWidth, imageHeight;
+    const Playfield *playfield;
+    const TileAtlas *tiles;
+    uint startRow, endRow;
+    QAtomicInt *nextBand;
+    QSemaphore *done;
+
+};
+
+/*
+  Same as drawTiles, but splits the tile map into bands of rows which are drawn on
+  several threads at once.
+
+  If numThreads is 0, the number of threads is based on the number of CPU cores.
+*/
+void PreviewRenderer::drawTilesParallel(QImage &image, const Playfield &playfield,
+                                        const TileAtlas &tiles, uint firstRow, uint endRow,
+                                        int numThreads) const {
+    if (numThreads <= 0)
+        numThreads = levelThreadPool()->maxThreadCount();
+
+    if (endRow <= firstRow)
+        return;
+
+    // no point in starting more threads than there are bands
+    int numBands = (endRow - firstRow + RENDER_BAND_ROWS - 1) / RENDER_BAND_ROWS;
+    numThreads = qBound(1, numThreads, numBands);
+
+    if (numThreads == 1) {
+        drawTiles(image, playfield, tiles, firstRow, endRow);
+        return;
+    }
+
+    if (numThreads > levelThreadPool()->maxThreadCount())
+        levelThreadPool()->setMaxThreadCount(numThreads);
+
+    // get the pixel data here, since QImage::bits() may detach the image
+    // (which isn't safe to do from several threads)
+    uchar *bits = image.bits();
+    QAtomicInt nextBand(0);
+    QSemaphore done;
+
+    for (int i = 0; i < numThreads; i++) {
+        levelThreadPool()->start(new RenderWorker(bits, image.bytesPerLine(),
+                                                   image.width(), image.height(),
+                                                   &playfield, &tiles, firstRow, endRow,
+                                                   &nextBand, &done));
+    }
+    done.acquire(numThreads);
+}
+
+QList<sprite_t> PreviewRenderer::sprites(const leveldata_t *level) const {
+    QList<sprite_t> sprites;
+
+    int mapHeight = levelHeight(level);
+    int mapWidth = level->header.width;
+    int mapLength = level->header.length;
+
+    // (see obstaclesprites.h for which obstacles get sprites)
+    for (int y = 0; y < mapLength; y++) {
+        for (int x = 0; x < mapWidth; x++) {
+            int obs = level->tiles[y][x].obstacle;
+            int z = level->tiles[y][x].height;
+
+            const obstacle_t &info = obstacleSprites[obs];
+            if (info.sheet3D == spriteNone) continue;
+
+            const QImage *gfx = &spriteSheets[info.sheet3D];
+            int frame = info.frame3D;
+
+            // horizontal: start at 0 pixels
+            // move TILE_SIZE / 2 right for each positive move on the x-axis (west to east)
+            // and  TILE_SIZE / 2 left  for each positive move on the y-axis (north to south)
+            int startX = (TILE_SIZE / 2) * (x + (mapLength - y - 1));
+            // start at h * TILE_SIZE / 4 tiles
+            // move TILE_SIZE / 4 down for each positive move on the x-axis (west to east)
+            // and  TILE_SIZE / 4 down for each positive move on the y-axis (north to south)
+            // and  TILE_SIZE / 4 up   for each positive move on the z-axis (tile z)
+            // and then adjust for height of sprites
+            int startY = (TILE_SIZE / 4) * (mapHeight + x + y - z + 4) - gfx->height();
+            // move down half a tile's worth if the sprite is on a slope
+            if (level->tiles[y][x].geometry >= stuff::slopes)
+                startY += TILE_SIZE / 8;
+
+            sprite_t sprite;
+            sprite.tile   = y * MAX_2D_SIZE + x;
+            sprite.gfx    = gfx;
+            sprite.source = QRect(frame * TILE_SIZE, 0, TILE_SIZE, gfx->height());
+            sprite.pos    = QPoint(startX, startY);
+
+            sprites.append(sprite);
+        }
+    }
+
+    return sprites;
+}
+
+void PreviewRenderer::drawSprites(QPainter &painter, const QList<sprite_t> &sprites) const {
+    for (const sprite_t &sprite: sprites)
+        painter.drawImage(sprite.pos, *sprite.gfx, sprite.source);
+}
@@ -0,0 +1,109 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef PREVIEWRENDERER_H
+#define PREVIEWRENDERER_H
+
+#include <QImage>
+#include <QPainter>
+#include <QList>
+#include <QRect>
+#include "level.h"
+#include "playfield.h"
+#include "tileatlas.h"
+#include "palette.h"
+#include "obstaclesprites.h"
+
+/*
+  A sprite drawn on top of the isometric view.
+*/
+typedef struct {
+    // which 2D map tile this sprite belongs to (y * MAX_2D_SIZE + x)
+    int           tile;
+    const QImage *gfx;
+    QRect         source;
+    QPoint        pos;
+} sprite_t;
+
+inline QRect spriteRect(const sprite_t &sprite) {
+    return QRect(sprite.pos, sprite.source.size());
+}
+
+inline bool operator==(const sprite_t &a, const sprite_t &b) {
+    return a.tile == b.tile && a.gfx == b.gfx && a.source == b.source && a.pos == b.pos;
+}
+
+inline bool operator!=(const sprite_t &a, const sprite_t &b) {
+    return !(a == b);
+}
+
+/*
+  Draws the isometric view of a level (the 8x8 tile map and the sprites) into an image.
+  The tile map is drawn by writing pixels straight into the image from the tile atlas,
+  instead of going through QPainter for each tile.
+
+  Tiles are drawn into 8-bit indexed images (see tileatlas.h); give these images the color
+  table from colorTable() to display them with the current palette.
+
+  This doesn't need a scene or a window, so it can also be used to export images
+  of levels directly.
+*/
+class PreviewRenderer {
+public:
+    PreviewRenderer();
+
+    // render the whole isometric view of a level in full color
+    // (numThreads is the number of threads used to draw the tiles; 0 = one per CPU core)
+    QImage render(const Playfield &playfield, const leveldata_t *level, bool sprites = true,
+                  int numThreads = 0) const;
+
+    // draw the tiles in rows [firstRow, endRow) of the tile map into an indexed image
+    // (which needs to be at least as big as the tile map; this doesn't need a renderer at all)
+    static void drawTiles(QImage &image, const Playfield &playfield, const TileAtlas &tiles,
+                          uint firstRow, uint endRow);
+    void   drawTilesParallel(QImage &image, const Playfield &playfield, const TileAtlas &tiles,
+                             uint firstRow, uint endRow, int numThreads = 0) const;
+    // draw the tiles in columns [firstCol, endCol) of one row of the tile map
+    void   drawCells(QImage &image, const Playfield &playfield, const TileAtlas &tiles,
+                     uint row, uint firstCol, uint endCol) const;
+
+    // draw a rectangle of tiles from the tile map into an image
+    // (where the top left of the image is at tile 'origin')
+    void   drawRegion(QImage &image, const QPoint &origin,
+                      const Playfield &playfield, const TileAtlas &tiles,
+                      const QRect &cells) const;
+
+    // find which 2D map tile is drawn at a pixel of the tile map
+    // (as y * MAX_2D_SIZE + x, or -1 if it's empty there)
+    int    tileAt(const Playfield &playfield, const TileAtlas &tiles, const QPoint &pos) const;
+
+    // get the position and graphics of each sprite in a level, in the order they're drawn
+    QList<sprite_t> sprites(const leveldata_t *level) const;
+    void   drawSprites(QPainter &painter, const QList<sprite_t> &sprites) const;
+
+    const TileAtlas& tilesFor(const leveldata_t *level) const;
+
+    // select the tile graphics for land and water levels (or null to use the bundled ones)
+    void   setTiles(const TileAtlas *land, const TileAtlas *water);
+    // select the course palettes (or null to use the tile sheets' own colors)
+    void   setPalette(const palettes_t *palettes, int fg, int water, bool night);
+    const QVector<QRgb>& colorTable(const leveldata_t *level) const;
+
+private:
+    // obstacle sprite sheets (see obstaclesprites.h)
+    QImage spriteSheets[NUM_SPRITE_SHEETS];
+    const TileAtlas *landTiles, *waterTiles;
+    QVector<QRgb> landColors, waterColors;
+    // where each of the tile sheets' colors comes from in the palettes
+    palettemap_t  landMap, waterMap;
+
+    const palettes_t *palettes;
+    int           fgPalette, waterPalette;
+    bool          night;
+
+    void mapColors();
+};
+
+#endif // PREVIEWRENDERER_H
@@ -5,204 +5,538 @@
   window to display the "real" view of the level being edited. In the future this may be used to add a
   mini preview to the tile edit window or something.
 
-  For the code which actually generates the isometric tile maps, see level.cpp.
+  The view is split up into square tiles which are only rendered once they're scrolled into view,
+  and the least recently seen ones are thrown away if they start using too much memory.
+  Tiles are rendered as indexed images, so switching palettes only changes their color tables.
+  This is also how water, conveyor belts and rotating spaces are animated (see previewanimation.cpp.)
+  The actual drawing is done by PreviewRenderer (see previewrenderer.cpp), and for the code which
+  actually generates the isometric tile maps, see level.cpp.
 
   This code is released under the terms of the MIT license.
   See COPYING.txt for details.
 */
 
-#include <QPixmap>
 #include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QGraphicsSceneMouseEvent>
+#include <QElapsedTimer>
 
 #include "previewscene.h"
 #include "graphics.h"
 #include "level.h"
-#include "mapscene.h"
 #include "metatile.h"
 
-PreviewScene::PreviewScene(QObject *parent, leveldata_t *currentLevel)
+// size of each tile of the preview, in 8x8 cells (32 cells = 256 pixels)
+#define PREVIEW_TILE_CELLS 32
+// how much memory rendered tiles can use before old ones are thrown away
+#define PREVIEW_CACHE_SIZE (32 * 1024 * 1024)
+// how often the animation's frame time is reported
+#define ANIM_REPORT_FRAMES 60
+
+PreviewTile::PreviewTile(PreviewScene *scene, const QRect &cells)
+    : QGraphicsItem(),
+      cells(cells),
+      preview(scene)
+{
+    this->setPos(cells.left() * ISO_TILE_SIZE, cells.top() * ISO_TILE_SIZE);
+    // needed to find out which part of the tile needs to be repainted
+    this->setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+QRectF PreviewTile::boundingRect() const {
+    return QRectF(0, 0, cells.width() * ISO_TILE_SIZE, cells.height() * ISO_TILE_SIZE);
+}
+
+void PreviewTile::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget*) {
+    QElapsedTimer timer;
+    timer.start();
+
+    preview->renderTile(this);
+
+    QRect exposed = option->exposedRect.toAlignedRect() & image.rect();
+    if (!exposed.isEmpty())
+        painter->drawImage(exposed.topLeft(), image, exposed);
+
+    preview->addPaintTime(timer.nsecsElapsed());
+}
+
+PreviewSprites::PreviewSprites()
+    : QGraphicsItem()
+{
+    this->setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    // always draw sprites on top of the tile map
+    this->setZValue(1);
+}
+
+QRectF PreviewSprites::boundingRect() const {
+    return QRectF(bounds);
+}
+
+void PreviewSprites::setBounds(const QRect &bounds) {
+    if (bounds != this->bounds)
+        this->prepareGeometryChange();
+
+    this->bounds = bounds;
+}
+
+void PreviewSprites::setSprites(const QList<sprite_t> &sprites) {
+    spriteList = sprites;
+}
+
+void PreviewSprites::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget*) {
+    QRect exposed = option->exposedRect.toAlignedRect();
+
+    for (const sprite_t &sprite: spriteList) {
+        if (spriteRect(sprite).intersects(exposed))
+            painter->drawImage(sprite.pos, *sprite.gfx, sprite.source);
+    }
+}
+
+PreviewHover::PreviewHover()
+    : QGraphicsItem()
+{
+    // always draw on top of the tile map and sprites
+    this->setZValue(2);
+    this->hide();
+}
+
+QRectF PreviewHover::boundingRect() const {
+    // (plus room for the outline)
+    return QRectF(-TILE_SIZE / 2 - 2, -TILE_SIZE / 4 - 2, TILE_SIZE + 4, TILE_SIZE / 2 + 4);
+}
+
+void PreviewHover::paint(QPainter *painter, const QStyleOptionGraphicsItem*, QWidget*) {
+    static const QPoint corners[] = {
+        QPoint(-TILE_SIZE / 2, 0), QPoint(0, -TILE_SIZE / 4),
+        QPoint( TILE_SIZE / 2, 0), QPoint(0,  TILE_SIZE / 4)
+    };
+
+    painter->setRenderHint(QPainter::Antialiasing);
+    painter->setPen(QPen(QColor(255, 255, 255, 224), 2));
+    painter->setBrush(QColor(255, 255, 255, 48));
+    painter->drawPolygon(corners, 4);
+}
+
+PreviewScene::PreviewScene(QObject *parent)
     : QGraphicsScene(parent),
-      level(currentLevel),
-      sprites(true)
+      level(),
+      maxHeight(0),
+      sprites(true),
+      tileCols(0), tileRows(0),
+      usedMemory(0),
+      spriteItem(new PreviewSprites()),
+      hoverItem(new PreviewHover()),
+      hoverX(-1), hoverY(-1),
+      lastTiles(NULL),
+      animated(false),
+      frame(0),
+      animTime(0), animFrames(0)
 {
-    // set up sprite pixmaps
-    dedede.load  (":images/dedede.png");
-    enemies.load (":images/enemies.png");
-    gordo.load   (":images/gordo3d.png");
-    player.load  (":images/kirby.png");
-}
-
-void PreviewScene::refresh(uint16_t (&playfield)[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH]) {
-
-    // load the 3d tile resource
-    // (NOTE: this is a temporary measure until actual graphic/palette
-    // loading is implemented)
-    // each palette zone is 216px tall and each row of tiles is
-    // 32 tiles long.
-    if (waterLevel(level))
-        tiles.load(":images/3dtiles-water.png");
-    else
-        tiles.load(":images/3dtiles.png");
+    this->addItem(spriteItem);
+    this->addItem(hoverItem);
 
-    int mapHeight = levelHeight(level);
-    int mapWidth = level->header.width;
-    int mapLength = level->header.length;
+    animTimer.setTimerType(Qt::PreciseTimer);
+    animTimer.setInterval(1000 / 60);
+    QObject::connect(&animTimer, SIGNAL(timeout()),
+                     this, SLOT(nextFrame()));
+}
+
+void PreviewScene::clearTiles() {
+    for (PreviewTile *tile: tiles)
+        delete tile;
+
+    tiles.clear();
+    usedTiles.clear();
+    usedMemory = 0;
+    tileCols = tileRows = 0;
+}
 
-    int width = qMin(MAX_FIELD_WIDTH, (int)level->header.fieldWidth);
-    int height = qMin(MAX_FIELD_HEIGHT, (int)level->header.fieldHeight);
+/*
+  Updates the preview based on a level and the tile map made from it. If the tile map is the
+  same size as before, only the rows and sprites which actually changed are redrawn.
+  The scene keeps its own copy of the level, so the level can keep being edited while a new
+  tile map is made for it.
+  If the whole tile map has already been drawn (e.g. by the preview window's prefetching),
+  tiles are copied from that image instead of being drawn when they become visible.
+*/
+void PreviewScene::refresh(const Playfield &playfield, const leveldata_t *snapshot,
+                           const QImage *rendered) {
+    level = *snapshot;
+    maxHeight = levelHeight(&level);
 
-    // reset the scene (remove all members)
-    this->clear();
+    // (the outlined tile may have moved)
+    setHover(hoverX, hoverY);
 
-    // set the pixmap and scene size based on the playfield's size
-    QPixmap pixmap(width * ISO_TILE_SIZE, height * ISO_TILE_SIZE);
-    pixmap.fill(QColor(0, 0, 0, 0));
+    const TileAtlas &atlas = renderer.tilesFor(&level);
+    const QVector<QRgb> &colors = renderer.colorTable(&level);
 
-    this->setSceneRect(0, 0, width * ISO_TILE_SIZE, height * ISO_TILE_SIZE);
+    int width = qMin(MAX_FIELD_WIDTH, (int)level.header.fieldWidth);
+    int height = qMin(MAX_FIELD_HEIGHT, (int)level.header.fieldHeight);
+
+    if (rendered && rendered->format() == QImage::Format_Indexed8
+            && rendered->size() == QSize(width * ISO_TILE_SIZE, height * ISO_TILE_SIZE))
+        lastImage = *rendered;
+    else
+        lastImage = QImage();
 
     // no level area = don't render anything
-    if (mapLength + mapWidth == 0) {
-        this->addPixmap(pixmap);
-        this->update();
+    bool empty = level.header.length + level.header.width == 0;
+
+    QList<sprite_t> newSprites;
+    if (sprites && !empty)
+        newSprites = renderer.sprites(&level);
+
+    if (empty || &atlas != lastTiles
+            || this->sceneRect() != QRectF(0, 0, width * ISO_TILE_SIZE, height * ISO_TILE_SIZE)
+            || playfield.width()  != lastPlayfield.width()
+            || playfield.height() != lastPlayfield.height()) {
+        // start over with a new set of tiles
+        // (which won't actually be rendered until they're visible)
+        lastPlayfield = playfield;
+        lastTiles = empty ? NULL : &atlas;
+        lastColors = colors;
+
+        clearTiles();
+        animation.clear();
+
+        if (!empty) {
+            tileCols = (width  + PREVIEW_TILE_CELLS - 1) / PREVIEW_TILE_CELLS;
+            tileRows = (height + PREVIEW_TILE_CELLS - 1) / PREVIEW_TILE_CELLS;
+
+            for (int y = 0; y < tileRows; y++) {
+                for (int x = 0; x < tileCols; x++) {
+                    QRect cells(x * PREVIEW_TILE_CELLS, y * PREVIEW_TILE_CELLS,
+                                qMin(PREVIEW_TILE_CELLS, width  - x * PREVIEW_TILE_CELLS),
+                                qMin(PREVIEW_TILE_CELLS, height - y * PREVIEW_TILE_CELLS));
+
+                    PreviewTile *tile = new PreviewTile(this, cells);
+                    tiles.append(tile);
+                    this->addItem(tile);
+                }
+            }
+        }
+
+        if (animated && !empty) {
+            animation.setLevel(&level, width, height);
+            updateAnimRects();
+        }
+        updateFrameColors();
+
+        // set the scene size based on the playfield's size
+        this->setSceneRect(0, 0, width * ISO_TILE_SIZE, height * ISO_TILE_SIZE);
+        spriteItem->setBounds(QRect(0, 0, width * ISO_TILE_SIZE, height * ISO_TILE_SIZE));
+        spriteItem->setSprites(newSprites);
+        spriteItem->update();
         return;
     }
 
-    // used to render one tile w/ flip etc. for each layer
-    QPixmap layer1tile(ISO_TILE_SIZE, ISO_TILE_SIZE);
-    QPixmap layer2tile(ISO_TILE_SIZE, ISO_TILE_SIZE);
+    // recolor everything if the palette changed (e.g. when switching to another course)
+    if (colors != lastColors)
+        setColors(colors);
 
-    QPainter layer1painter, layer2painter;
-    QPainter painter;
+    // find the part of each row which changed
+    QVector<QRect> changed;
+    for (int h = 0; h < height; h++) {
+        uint first, last;
+        if (playfield.diffRow(lastPlayfield, h, &first, &last))
+            changed.append(QRect(first, h, last - first + 1, 1));
+    }
 
-    painter.begin(&pixmap);
+    // as well as any cells which started or stopped being animated
+    if (animated) {
+        changed += animation.setLevel(&level, width, height);
+        updateAnimRects();
+    }
 
-    for (int h = 0; h < height; h++) {
-        for (int w = 0; w < width; w++) {
-            layer1tile.fill(QColor(0,0,0,0));
-            layer2tile.fill(QColor(0,0,0,0));
-
-            uint16_t tile1 = playfield[0][h][w];
-            if (TILE(tile1)) {
-                int      y1    = (TILE(tile1) / 32) * ISO_TILE_SIZE
-                               + (PALN(tile1) * 216);
-                int      x1    = (TILE(tile1) % 32) * ISO_TILE_SIZE;
-
-                layer1painter.begin(&layer1tile);
-                layer1painter.drawPixmap(0, 0,
-                                         tiles, x1, y1, ISO_TILE_SIZE, ISO_TILE_SIZE);
-                layer1painter.end();
-
-                // flip the pixmap horizontally and/or vertically
-                layer1tile = QPixmap::fromImage(layer1tile.toImage().mirrored(tile1 & FH, tile1 & FV));
+    // and only redraw those
+    lastPlayfield = playfield;
+    for (const QRect &cells: changed)
+        redrawCells(cells);
+
+    // find which sprites were added, removed or moved
+    // (both lists are in the same order, by 2D map position)
+    const QList<sprite_t> &oldSprites = spriteItem->sprites();
+    int i = 0, j = 0;
+    while (i < oldSprites.size() || j < newSprites.size()) {
+        if (j >= newSprites.size()
+                || (i < oldSprites.size() && oldSprites[i].tile < newSprites[j].tile)) {
+            spriteItem->update(spriteRect(oldSprites[i++]));
+
+        } else if (i >= oldSprites.size() || newSprites[j].tile < oldSprites[i].tile) {
+            spriteItem->update(spriteRect(newSprites[j++]));
+
+        } else {
+            if (oldSprites[i] != newSprites[j]) {
+                spriteItem->update(spriteRect(oldSprites[i]));
+                spriteItem->update(spriteRect(newSprites[j]));
             }
+            i++;
+            j++;
+        }
+    }
 
-            uint16_t tile2 = playfield[1][h][w];
-            if (TILE(tile2)) {
-                int      y2    = (TILE(tile2) / 32) * ISO_TILE_SIZE
-                               + (PALN(tile2) * 216);
-                int      x2    = (TILE(tile2) % 32) * ISO_TILE_SIZE;
+    spriteItem->setSprites(newSprites);
+}
 
-                layer2painter.begin(&layer2tile);
-                layer2painter.drawPixmap(0, 0,
-                                         tiles, x2, y2, ISO_TILE_SIZE, ISO_TILE_SIZE);
-                layer2painter.end();
+void PreviewScene::setPalette(const palettes_t *palettes, int fg, int water, bool night) {
+    renderer.setPalette(palettes, fg, water, night);
 
-                // flip the pixmap horizontally and/or vertically
-                layer2tile = QPixmap::fromImage(layer2tile.toImage().mirrored(tile2 & FH, tile2 & FV));
-            }
+    const QVector<QRgb> &colors = renderer.colorTable(&level);
+    if (colors != lastColors)
+        setColors(colors);
+}
 
-            // draw the tile pixmaps onto the scene
-            // if layer 1 has priority, draw layer 2 first
-            if (tile1 & PRI) {
-                painter.drawPixmap(w * ISO_TILE_SIZE, h * ISO_TILE_SIZE, layer2tile);
-                painter.drawPixmap(w * ISO_TILE_SIZE, h * ISO_TILE_SIZE, layer1tile);
-            } else {
-                painter.drawPixmap(w * ISO_TILE_SIZE, h * ISO_TILE_SIZE, layer1tile);
-                painter.drawPixmap(w * ISO_TILE_SIZE, h * ISO_TILE_SIZE, layer2tile);
-            }
-        }
+/*
+  Changes the color table of every tile which has already been rendered.
+*/
+void PreviewScene::setColors(const QVector<QRgb> &colors) {
+    lastColors = colors;
+    updateFrameColors();
+
+    for (PreviewTile *tile: usedTiles) {
+        tile->image.setColorTable(frameColors);
+        tile->update();
     }
-    // next, if sprites are enabled, draw them
-    // most of this is copied from the 2D draw code
-    if (sprites) {
-        for (int y = 0; y < mapLength; y++) {
-            for (int x = 0; x < mapWidth; x++) {
-                QPixmap gfx;
-                int frame;
-                int obs = level->tiles[y][x].obstacle;
-                int z = level->tiles[y][x].height;
-
-                if (obs == 0) continue;
-
-                // whispy woods (index 0x00 in enemies.png)
-                if (obs == 0x02) {
-                    gfx = enemies;
-                    frame = 0;
-
-                // kirby's start pos (kirby.png)
-                // (this time also use the final boss version)
-                } else if (obs == 0x0c || obs == 0xc3) {
-                    gfx = player;
-                    frame = 0;
-
-                // dedede (frame 0 in dedede.png)
-                } else if (obs == 0x0d) {
-                    gfx = dedede;
-                    frame = 0;
-
-                // most enemies (ind. 01 to 13 in enemies.png)
-                } else if (obs >= 0x40 && obs <= 0x52) {
-                    gfx = enemies;
-                    frame = obs - 0x40 + 1;
-
-                // transformer (ind. 14 in enemies.png
-                } else if (obs == 0x57) {
-                    gfx = enemies;
-                    frame = 0x14;
-
-                // gordo (ind. 00 to 21 in gordo.png)
-                } else if (obs >= 0x80 && obs <= 0x97) {
-                    gfx = gordo;
-                    frame = obs - 0x80;
-
-                // kracko (index 15-17 in enemies.png)
-                } else if (obs >= 0xac && obs <= 0xae) {
-                    gfx = enemies;
-                    frame = obs - 0xac + 0x15;
-
-                // anything else - question mark (or don't draw)
-                } else {
-                    obs = 0;
-                }
+}
 
-                // draw the selected obstacle
-                if (obs) {
-                    // horizontal: start at 0 pixels
-                    // move TILE_SIZE / 2 right for each positive move on the x-axis (west to east)
-                    // and  TILE_SIZE / 2 left  for each positive move on the y-axis (north to south)
-                    int startX = (TILE_SIZE / 2) * (x + (mapLength - y - 1));
-                    // start at h * TILE_SIZE / 4 tiles
-                    // move TILE_SIZE / 4 down for each positive move on the x-axis (west to east)
-                    // and  TILE_SIZE / 4 down for each positive move on the y-axis (north to south)
-                    // and  TILE_SIZE / 4 up   for each positive move on the z-axis (tile z)
-                    // and then adjust for height of sprites
-                    int startY = (TILE_SIZE / 4) * (mapHeight + x + y - z + 4) - gfx.height();
-                    // move down half a tile's worth if the sprite is on a slope
-                    if (level->tiles[y][x].geometry >= stuff::slopes)
-                        startY += TILE_SIZE / 8;
-
-                    painter.drawPixmap(startX, startY,
-                                       gfx, frame * TILE_SIZE, 0,
-                                       TILE_SIZE, gfx.height());
-                }
-            }
+void PreviewScene::updateFrameColors() {
+    frameColors = animated ? animation.colorTable(lastColors, frame) : lastColors;
+}
+
+/*
+  Finds which parts of each tile need to be repainted for each frame of animation.
+*/
+void PreviewScene::updateAnimRects() {
+    for (PreviewTile *tile: tiles)
+        tile->animRects.clear();
+
+    for (const QRect &span: animation.spans()) {
+        int row = span.top() / PREVIEW_TILE_CELLS;
+        if (row >= tileRows) continue;
+
+        for (int col = span.left() / PREVIEW_TILE_CELLS;
+             col <= span.right() / PREVIEW_TILE_CELLS && col < tileCols; col++) {
+            PreviewTile *tile = tiles[row * tileCols + col];
+            QRect cells = span & tile->cells;
+
+            tile->animRects.append(QRect((cells.left() - tile->cells.left()) * ISO_TILE_SIZE,
+                                         (cells.top()  - tile->cells.top())  * ISO_TILE_SIZE,
+                                         cells.width() * ISO_TILE_SIZE, ISO_TILE_SIZE));
         }
     }
+}
+
+/*
+  Switches the animated cells in part of a tile over to the animated colors,
+  after they've been drawn.
+*/
+void PreviewScene::animateCells(PreviewTile *tile, const QRect &cells) {
+    if (!animated) return;
 
-    // finally, add the 3d map pixmap onto the scene
-    painter.end();
+    int numColors = animation.numColors();
+    animation.remap(tile->image, tile->cells.topLeft(), cells);
 
-    this->addPixmap(pixmap);
+    // make sure any new animated colors are in the color table
+    if (animation.numColors() != numColors)
+        updateFrameColors();
+
+    tile->image.setColorTable(frameColors);
+}
+
+void PreviewScene::setAnimated(bool on) {
+    if (on == animated) return;
+
+    animated = on;
+    frame = 0;
+    animTime = animFrames = 0;
+
+    animation.clear();
+    if (on && lastTiles)
+        animation.setLevel(&level, sceneRect().width()  / ISO_TILE_SIZE,
+                                  sceneRect().height() / ISO_TILE_SIZE);
+    updateAnimRects();
+    updateFrameColors();
+
+    // throw away everything that's been rendered so far,
+    // so it can be rendered again with (or without) the animated colors
+    for (PreviewTile *tile: usedTiles)
+        tile->image = QImage();
+    usedTiles.clear();
+    usedMemory = 0;
     this->update();
+
+    if (on)
+        animTimer.start();
+    else
+        animTimer.stop();
+}
+
+/*
+  Shows the next frame of animation by changing the animated colors and repainting
+  the animated cells of any tiles which have already been rendered.
+*/
+void PreviewScene::nextFrame() {
+    QElapsedTimer timer;
+    timer.start();
+
+    frame++;
+
+    // most of the time nothing changes from one frame to the next
+    QVector<QRgb> lastFrameColors = frameColors;
+    updateFrameColors();
+
+    if (frameColors != lastFrameColors) {
+        for (PreviewTile *tile: usedTiles) {
+            if (tile->animRects.isEmpty()) continue;
+
+            tile->image.setColorTable(frameColors);
+            for (const QRect &rect: tile->animRects)
+                tile->update(rect);
+        }
+    }
+
+    animTime += timer.nsecsElapsed();
+    if (++animFrames == ANIM_REPORT_FRAMES) {
+        emit frameTime(animTime / (animFrames * 1000000.0));
+        animTime = animFrames = 0;
+    }
+}
+
+/*
+  Redraws part of the tile map in any tiles which have already been rendered.
+  (Tiles which haven't been rendered yet will be up to date once they are.)
+*/
+void PreviewScene::redrawCells(const QRect &cells) {
+    int firstCol = cells.left()  / PREVIEW_TILE_CELLS;
+    int lastCol  = qMin(cells.right()  / PREVIEW_TILE_CELLS, tileCols - 1);
+    int firstRow = cells.top()   / PREVIEW_TILE_CELLS;
+    int lastRow  = qMin(cells.bottom() / PREVIEW_TILE_CELLS, tileRows - 1);
+
+    for (int y = firstRow; y <= lastRow; y++) {
+        for (int x = firstCol; x <= lastCol; x++) {
+            PreviewTile *tile = tiles[y * tileCols + x];
+            if (tile->image.isNull()) continue;
+
+            renderer.drawRegion(tile->image, tile->cells.topLeft(),
+                                lastPlayfield, *lastTiles, cells);
+            animateCells(tile, cells);
+
+            QRect changed = cells & tile->cells;
+            tile->update((changed.left() - tile->cells.left()) * ISO_TILE_SIZE,
+                         (changed.top()  - tile->cells.top())  * ISO_TILE_SIZE,
+                         changed.width()  * ISO_TILE_SIZE,
+                         changed.height() * ISO_TILE_SIZE);
+        }
+    }
+}
+
+void PreviewScene::renderTile(PreviewTile *tile) {
+    if (!tile->image.isNull()) {
+        // move it to the end of the list
+        usedTiles.removeOne(tile);
+        usedTiles.append(tile);
+        return;
+    }
+
+    if (lastTiles && !lastImage.isNull()) {
+        // the whole tile map was already drawn, so just copy this part of it
+        tile->image = lastImage.copy(tile->cells.left()   * ISO_TILE_SIZE,
+                                     tile->cells.top()    * ISO_TILE_SIZE,
+                                     tile->cells.width()  * ISO_TILE_SIZE,
+                                     tile->cells.height() * ISO_TILE_SIZE);
+    } else {
+        tile->image = QImage(tile->cells.width()  * ISO_TILE_SIZE,
+                             tile->cells.height() * ISO_TILE_SIZE,
+                             QImage::Format_Indexed8);
+    }
+    tile->image.setColorTable(frameColors);
+
+    if (lastTiles) {
+        if (lastImage.isNull())
+            renderer.drawRegion(tile->image, tile->cells.topLeft(),
+                                lastPlayfield, *lastTiles, tile->cells);
+        animateCells(tile, tile->cells);
+    } else {
+        tile->image.fill(0);
+    }
+
+    usedTiles.append(tile);
+    usedMemory += tile->image.sizeInBytes();
+
+    // throw away the least recently used tiles if there are too many
+    while (usedMemory > PREVIEW_CACHE_SIZE && usedTiles.size() > 1) {
+        PreviewTile *oldTile = usedTiles.takeFirst();
+
+        usedMemory -= oldTile->image.sizeInBytes();
+        oldTile->image = QImage();
+    }
+}
+
+QImage PreviewScene::image() const {
+    if (!lastTiles)
+        return QImage();
+
+    return renderer.render(lastPlayfield, &level, sprites);
+}
+
+int PreviewScene::tileAt(const QPointF &pos) const {
+    if (!lastTiles || pos.x() < 0 || pos.y() < 0)
+        return -1;
+
+    return renderer.tileAt(lastPlayfield, *lastTiles, QPoint(pos.x(), pos.y()));
 }
 
+QPoint PreviewScene::tileCenter(int x, int y) const {
+    const maptile_t &tile = level.tiles[y][x];
+
+    // start at 32 pixels
+    // move 32 right for each positive move on the x-axis (west to east)
+    // and  32 left  for each positive move on the y-axis (north to south)
+    int centerX = (TILE_SIZE / 2) * (x + level.header.length - y);
+    // start at 16 * (h + 1) pixels
+    // move 16 down for each positive move on the x-axis (west to east)
+    // and  16 down for each positive move on the y-axis (north to south)
+    // and  16 up   for each positive move on the z-axis (tile z)
+    int centerY = (TILE_SIZE / 4) * (maxHeight + x + y - tile.height + 1);
+    // (slopes are drawn a bit lower)
+    if (tile.geometry >= stuff::slopes)
+        centerY += TILE_SIZE / 8;
+
+    return QPoint(centerX, centerY);
+}
+
+void PreviewScene::setHover(int x, int y) {
+    hoverX = x;
+    hoverY = y;
+
+    if (x < 0 || y < 0 || x >= level.header.width || y >= level.header.length
+            || !level.tiles[y][x].geometry) {
+        hoverItem->hide();
+        return;
+    }
+
+    hoverItem->setPos(tileCenter(x, y));
+    hoverItem->show();
+}
+
+void PreviewScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
+    int tile = tileAt(event->scenePos());
+    int x = tile >= 0 ? tile % MAX_2D_SIZE : -1;
+    int y = tile >= 0 ? tile / MAX_2D_SIZE : -1;
+
+    if (x != hoverX || y != hoverY) {
+        setHover(x, y);
+        emit tileHovered(x, y);
+    }
+
+    event->accept();
+}
+
+void PreviewScene::mousePressEvent(QGraphicsSceneMouseEvent *event) {
+    int tile = tileAt(event->scenePos());
+
+    if (tile >= 0 && event->button() == Qt::LeftButton)
+        emit tileClicked(tile % MAX_2D_SIZE, tile / MAX_2D_SIZE);
+
+    event->accept();
+}
@@ -6,22 +6,167 @@
 #ifndef PREVIEWSCENE_H
 #define PREVIEWSCENE_H
 
-#include <QPixmap>
+#include <QImage>
+#include <QList>
+#include <QVector>
+#include <QTimer>
 #include <QtWidgets/QGraphicsScene>
+#include <QtWidgets/QGraphicsItem>
 #include "level.h"
+#include "playfield.h"
+#include "previewrenderer.h"
+#include "previewanimation.h"
+
+class PreviewScene;
+
+/*
+  One square piece of the rendered tile map.
+  The image is only rendered once the tile is actually visible, and may be thrown away
+  again later if it hasn't been seen in a while (see PreviewScene).
+*/
+class PreviewTile : public QGraphicsItem {
+public:
+    PreviewTile(PreviewScene *scene, const QRect &cells);
+
+    QRectF boundingRect() const;
+    void   paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
+    // which cells of the tile map this tile covers
+    const QRect cells;
+    QImage      image;
+    // parts of the image (in pixels) which contain animated cells
+    QVector<QRect> animRects;
+
+private:
+    PreviewScene *preview;
+};
+
+/*
+  Graphics item which draws the sprites on top of the tile map.
+*/
+class PreviewSprites : public QGraphicsItem {
+public:
+    PreviewSprites();
+
+    QRectF boundingRect() const;
+    void   paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
+    const QList<sprite_t>& sprites() const { return spriteList; }
+    void   setSprites(const QList<sprite_t> &sprites);
+    // the area sprites can be drawn in (i.e. the whole tile map)
+    void   setBounds(const QRect &bounds);
+
+private:
+    QList<sprite_t> spriteList;
+    QRect           bounds;
+};
+
+/*
+  Graphics item which outlines the top of one 2D map tile (the one under the mouse in either
+  the preview or the 2D map), so moving the mouse around doesn't redraw any of the tile map.
+*/
+class PreviewHover : public QGraphicsItem {
+public:
+    PreviewHover();
+
+    QRectF boundingRect() const;
+    void   paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+};
 
 class PreviewScene : public QGraphicsScene {
     Q_OBJECT
 
 private:
-    leveldata_t *level;
+    // the level as of the last refresh
+    leveldata_t level;
+    // and its maximum tile height
+    int  maxHeight;
     bool sprites;
 
-    QPixmap tiles, dedede, enemies, gordo, player;
+    PreviewRenderer renderer;
+
+    // the tile map is split up into tiles, which are only rendered when they're needed
+    int                   tileCols, tileRows;
+    QVector<PreviewTile*> tiles;
+    // tiles which currently have an image, from least to most recently used
+    QList<PreviewTile*>   usedTiles;
+    size_t                usedMemory;
+
+    PreviewSprites       *spriteItem;
+    PreviewHover         *hoverItem;
+    // which 2D map tile is outlined (or -1, -1)
+    int                   hoverX, hoverY;
+
+    // the last playfield, tiles and colors that were drawn, to find out what changed
+    Playfield        lastPlayfield;
+    const TileAtlas *lastTiles;
+    QVector<QRgb>    lastColors;
+    // the whole tile map already drawn with lastTiles, if it was given to refresh()
+    // (tiles are then copied from this instead of being drawn)
+    QImage           lastImage;
+
+    // palette cycling animation (see previewanimation.h)
+    PreviewAnimation animation;
+    bool             animated;
+    QTimer           animTimer;
+    int              frame;
+    // colors for the current frame of animation
+    QVector<QRgb>    frameColors;
+    // time spent animating (updating and painting) since the frame time was last reported
+    qint64           animTime;
+    int              animFrames;
+
+    void clearTiles();
+    void redrawCells(const QRect &cells);
+    void setColors(const QVector<QRgb> &colors);
+    void updateFrameColors();
+    void updateAnimRects();
+    void animateCells(PreviewTile *tile, const QRect &cells);
+
+private slots:
+    void nextFrame();
+
+signals:
+    // average time taken by each frame of animation, in milliseconds
+    void frameTime(double ms);
+    // the mouse moved onto a different 2D map tile (or off of the level, if -1, -1)
+    void tileHovered(int x, int y);
+    void tileClicked(int x, int y);
+
+protected:
+    void mouseMoveEvent(QGraphicsSceneMouseEvent *event);
+    void mousePressEvent(QGraphicsSceneMouseEvent *event);
 
 public:
-    PreviewScene(QObject *parent, leveldata_t *currentLevel);
-    void refresh(uint16_t (&playfield)[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH]);
+    PreviewScene(QObject *parent);
+    // (rendered is the tile map already drawn with tilesFor(snapshot), if there is one)
+    void refresh(const Playfield &playfield, const leveldata_t *snapshot,
+                 const QImage *rendered = NULL);
+    // change the course palettes without redrawing anything (see PreviewRenderer)
+    void setPalette(const palettes_t *palettes, int fg, int water, bool night);
+    // the tile graphics a level would be drawn with
+    const TileAtlas* tilesFor(const leveldata_t *level) const { return &renderer.tilesFor(level); }
+
+    // start or stop animating water, conveyor belts, etc.
+    void setAnimated(bool on);
+
+    // render a tile's image if needed, and mark it as recently used
+    void renderTile(PreviewTile *tile);
+    // count time spent painting tiles towards the animation's frame time
+    void addPaintTime(qint64 nsecs) { if (animated) animTime += nsecs; }
+
+    // the current view of the level, including sprites
+    QImage image() const;
+
+    // which 2D map tile is drawn at a point (as y * MAX_2D_SIZE + x, or -1 if none)
+    int    tileAt(const QPointF &pos) const;
+    // the center of the top of a 2D map tile
+    QPoint tileCenter(int x, int y) const;
+    // outline a 2D map tile (or nothing, if it's off of the level)
+    void   setHover(int x, int y);
+
+    // how much memory is used by the rendered tiles
+    size_t memoryUsage() const { return usedMemory; }
 };
 
 #endif // PREVIEWSCENE_H
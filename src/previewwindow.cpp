@@ -9,9 +9,72 @@
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QGraphicsScene>
-#include <QGraphicsPixmapItem>
 #include <QSettings>
+#include <QThreadPool>
 #include "previewscene.h"
+#include "previewrenderer.h"
+
+// how long to wait after an edit before making a new tile map (in msec)
+#define PREVIEW_DELAY 16
+// how long to wait after an edit before prefetching other levels (in msec)
+#define PREFETCH_DELAY 500
+// number of rows of 8x8 tiles drawn by a prefetch worker between checks for newer edits
+#define PREFETCH_ROWS 32
+
+PreviewWorker::PreviewWorker(const leveldata_t *level, const QAtomicInt *generation,
+                             const TileAtlas *tiles)
+    : QObject(),
+      level(*level),
+      key(levelHash(level)),
+      generation(generation->load()),
+      latest(generation),
+      cancelled(false),
+      tiles(tiles)
+{
+    this->setAutoDelete(false);
+}
+
+void PreviewWorker::run() {
+    if (!tiles) {
+        makeIsometricMapParallel(playfield, &level);
+
+    } else {
+        // prefetching happens in the background, so stay on one thread,
+        // and give up as soon as the current level is edited (which needs the thread more)
+        cancelled = latest->load() != (int)generation;
+        if (!cancelled)
+            makeIsometricMap(playfield, &level);
+
+        int width  = qMin(MAX_FIELD_WIDTH,  (int)level.header.fieldWidth);
+        int height = qMin(MAX_FIELD_HEIGHT, (int)level.header.fieldHeight);
+
+        if (!cancelled && level.header.length + level.header.width != 0 && width && height) {
+            image = QImage(width * ISO_TILE_SIZE, height * ISO_TILE_SIZE, QImage::Format_Indexed8);
+
+            for (int row = 0; row < height && !image.isNull(); row += PREFETCH_ROWS) {
+                cancelled = latest->load() != (int)generation;
+                if (cancelled) break;
+
+                PreviewRenderer::drawTiles(image, playfield, *tiles,
+                                           row, qMin(row + PREFETCH_ROWS, height));
+            }
+        }
+    }
+
+    emit finished();
+}
+
+preview_t* PreviewWorker::makePreview() const {
+    preview_t *preview = new preview_t;
+
+    preview->playfield   = playfield;
+    preview->fieldWidth  = level.header.fieldWidth;
+    preview->fieldHeight = level.header.fieldHeight;
+    preview->tiles       = image.isNull() ? NULL : tiles;
+    preview->image       = image;
+
+    return preview;
+}
 
 PreviewWindow::PreviewWindow(QWidget *parent, leveldata_t *currentLevel) :
     QDialog(parent, Qt::Tool
@@ -23,8 +86,15 @@ PreviewWindow::PreviewWindow(QWidget *parent, leveldata_t *currentLevel) :
             ),
     ui(new Ui::PreviewWindow),
     level(currentLevel),
-    scene(new PreviewScene(this, currentLevel)),
-    center(true)
+    scene(new PreviewScene(this)),
+    center(true),
+    palettes(NULL),
+    fgPalette(0), waterPalette(0),
+    night(false),
+    worker(NULL),
+    generation(0),
+    pending(false),
+    prefetchWorker(NULL)
 {
     ui->setupUi(this);
 
@@ -32,11 +102,38 @@ PreviewWindow::PreviewWindow(QWidget *parent, leveldata_t *currentLevel) :
     this->layout()->setContentsMargins(0,0,0,0);
 
     ui->graphicsView->setScene(scene);
+
+    QObject::connect(scene, SIGNAL(frameTime(double)),
+                     this, SLOT(showFrameTime(double)));
+    QObject::connect(scene, SIGNAL(tileHovered(int,int)),
+                     this, SIGNAL(tileHovered(int,int)));
+    QObject::connect(scene, SIGNAL(tileClicked(int,int)),
+                     this, SIGNAL(tileClicked(int,int)));
+
+    timer.setSingleShot(true);
+    timer.setInterval(PREVIEW_DELAY);
+    QObject::connect(&timer, SIGNAL(timeout()),
+                     this, SLOT(startWorker()));
+
+    // (one thread for the current level and one for prefetching)
+    pool.setMaxThreadCount(2);
+
+    prefetchTimer.setSingleShot(true);
+    prefetchTimer.setInterval(PREFETCH_DELAY);
+    QObject::connect(&prefetchTimer, SIGNAL(timeout()),
+                     this, SLOT(startPrefetch()));
 }
 
 
 PreviewWindow::~PreviewWindow()
 {
+    // don't leave a worker running with nowhere to go
+    if (worker || prefetchWorker) {
+        pool.waitForDone();
+        delete worker;
+        delete prefetchWorker;
+    }
+
     delete ui;
 }
 
@@ -45,47 +142,171 @@ void PreviewWindow::setLevel(leveldata_t *level) {
     refresh();
 }
 
+/*
+  Changes the palettes used for the current course.
+  (this doesn't need to rebuild or redraw the tile map)
+*/
+void PreviewWindow::setPalette(const palettes_t *palettes, int fg, int water) {
+    this->palettes = palettes;
+    fgPalette    = fg;
+    waterPalette = water;
+
+    scene->setPalette(palettes, fg, water, night);
+}
+
+void PreviewWindow::setCacheSize(size_t bytes) {
+    cache.setMaxSize(bytes);
+}
+
 void PreviewWindow::refresh() {
-    // rebuild the 3D tile map
-    makeIsometricMap(this->playfield, this->level);
-    // and draw it
-    scene->refresh(this->playfield);
-    // refresh the display
+    // anything already in progress is out of date now
+    generation.ref();
+
+    // if the level looks exactly like one seen recently, show that right away;
+    // otherwise (re)start the timer, so the worker only runs once the level stops changing
+    const preview_t *preview = cache.find(levelHash(level));
+    if (preview) {
+        timer.stop();
+        pending = false;
+        showPreview(preview);
+    } else {
+        timer.start();
+    }
+
+    // and put off prefetching until things settle down again
+    prefetchTimer.start();
+}
+
+/*
+  Shows a finished tile map for the current level.
+*/
+void PreviewWindow::showPreview(const preview_t *preview) {
+    // (making the tile map also calculates its size)
+    level->header.fieldWidth  = preview->fieldWidth;
+    level->header.fieldHeight = preview->fieldHeight;
+
+    // use the already drawn tile map too, if it was drawn with the right tiles
+    bool rendered = !preview->image.isNull() && preview->tiles == scene->tilesFor(level);
+    scene->refresh(preview->playfield, level, rendered ? &preview->image : NULL);
     ui->graphicsView->update();
 }
 
+void PreviewWindow::startWorker() {
+    // only run one worker at a time; if one is already running, then
+    // start another one once it's done
+    if (worker) {
+        pending = true;
+        return;
+    }
+    pending = false;
+
+    worker = new PreviewWorker(level, &generation);
+    QObject::connect(worker, SIGNAL(finished()),
+                     this, SLOT(workerFinished()));
+    pool.start(worker);
+}
+
+void PreviewWindow::workerFinished() {
+    // keep the tile map around even if it's out of date,
+    // since the level may still end up looking like this again (e.g. after an undo)
+    cache.insert(worker->getKey(), worker->makePreview());
+
+    // only show the new tile map if the level hasn't been edited since the worker started
+    if (worker->getGeneration() == (uint)generation.load())
+        showPreview(cache.find(worker->getKey()));
+
+    worker->deleteLater();
+    worker = NULL;
+
+    if (pending)
+        startWorker();
+}
+
+void PreviewWindow::prefetch(const QList<const leveldata_t*> &levels) {
+    prefetchLevels.clear();
+    for (const leveldata_t *level: levels)
+        prefetchLevels.append(*level);
+
+    prefetchTimer.start();
+}
+
 /*
-  Converts 2D map coordinates into 3D display coordinates
-  in order to center the preview display on a specific tile.
+  Starts making the tile map for the next level waiting to be prefetched
+  which isn't already in the cache.
 */
-void PreviewWindow::centerOn(int x, int y) {
-    if (!center) return;
+void PreviewWindow::startPrefetch() {
+    // wait for the current level's tile map to be done first
+    if (worker || timer.isActive()) {
+        prefetchTimer.start();
+        return;
+    }
+    if (prefetchWorker) return;
 
-    int z = level->tiles[y][x].height;
-    int h = levelHeight(level);
-    int l = level->header.length;
+    while (!prefetchLevels.isEmpty()) {
+        leveldata_t next = prefetchLevels.takeFirst();
+        const TileAtlas *tiles = scene->tilesFor(&next);
 
-    // start at 32 pixels
-    // move 32 right for each positive move on the x-axis (west to east)
-    // and  32 left  for each positive move on the y-axis (north to south)
-    int centerX = 32 * (x + l - y);
-    // start at 16 *(h + 1) pixels
-    // move 16 down for each positive move on the x-axis (west to east)
-    // and  16 down for each positive move on the y-axis (north to south)
-    // and  16 up   for each positive move on the z-axis (tile z)
-    int centerY = 16 * (h + x + y - z + 1);
+        const preview_t *preview = cache.find(levelHash(&next));
+        if (preview && preview->tiles == tiles) continue;
 
-    ui->graphicsView->centerOn(centerX, centerY);
+        prefetchWorker = new PreviewWorker(&next, &generation, tiles);
+        QObject::connect(prefetchWorker, SIGNAL(finished()),
+                         this, SLOT(prefetchFinished()));
+        pool.start(prefetchWorker);
+        break;
+    }
+}
+
+void PreviewWindow::prefetchFinished() {
+    if (!prefetchWorker->isCancelled())
+        cache.insert(prefetchWorker->getKey(), prefetchWorker->makePreview());
+
+    prefetchWorker->deleteLater();
+    prefetchWorker = NULL;
+
+    // keep going, unless the level was edited in the meantime
+    // (in which case the timer will start the next one later)
+    if (!prefetchTimer.isActive())
+        startPrefetch();
+}
+
+/*
+  Outlines a tile of the 2D map in the 3D display, and centers the display on it
+  (if enabled.)
+*/
+void PreviewWindow::centerOn(int x, int y) {
+    scene->setHover(x, y);
+
+    if (!center || x < 0 || y < 0 || x >= MAX_2D_SIZE || y >= MAX_2D_SIZE) return;
+
+    ui->graphicsView->centerOn(scene->tileCenter(x, y));
 }
 
 void PreviewWindow::enableCenter(bool center) {
     this->center = center;
 }
 
+void PreviewWindow::enableNight(bool night) {
+    this->night = night;
+
+    scene->setPalette(palettes, fgPalette, waterPalette, night);
+}
+
+void PreviewWindow::enableAnimation(bool on) {
+    scene->setAnimated(on);
+
+    if (!on)
+        this->setWindowTitle(tr("Preview"));
+}
+
+void PreviewWindow::showFrameTime(double ms) {
+    this->setWindowTitle(tr("Preview (%1 ms/frame)").arg(ms, 0, 'f', 2));
+}
+
 void PreviewWindow::savePreview() {
-    QList<QGraphicsItem*> items = scene->items();
+    QImage image = scene->image();
 
-    if (!items.size()) {
+    if (image.isNull() || level->header.length == 0) {
         QMessageBox::information(NULL, tr("Save Level to Image"),
                                  tr("No level is currently open."),
                                  QMessageBox::Ok);
@@ -99,7 +320,7 @@ void PreviewWindow::savePreview() {
                                  settings.value("PreviewWindow/fileName", "").toString(),
                                  tr("PNG image (*.png)"));
     if (!imageName.isNull()) {
-        if (!((QGraphicsPixmapItem*)items[0])->pixmap().save(imageName)) {
+        if (!image.save(imageName)) {
             QMessageBox::warning(NULL, tr("Save Level to Image"),
                                  tr("Error saving %1.").arg(imageName),
                                  QMessageBox::Ok);
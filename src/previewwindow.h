@@ -7,13 +7,66 @@
 #define PREVIEWWINDOW_H
 
 #include <QtWidgets/QDialog>
+#include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QTimer>
+#include <QList>
 #include "level.h"
 #include "previewscene.h"
+#include "previewcache.h"
+#include "playfield.h"
+#include "palette.h"
 
 namespace Ui {
 class PreviewWindow;
 }
 
+/*
+  Worker object for making a level's tile map in the background.
+  Works on its own copy of the level, so the level can keep being edited.
+  If given a set of tiles, it also draws the whole tile map with them (for prefetching.)
+  Prefetching stops early if the current level is edited while it's running.
+*/
+class PreviewWorker : public QObject, public QRunnable {
+    Q_OBJECT
+
+public:
+    PreviewWorker(const leveldata_t *level, const QAtomicInt *generation,
+                  const TileAtlas *tiles = NULL);
+
+    void run();
+
+    const leveldata_t* getLevel() const { return &level; }
+    const QByteArray&  getKey() const { return key; }
+    const Playfield&   getPlayfield() const { return playfield; }
+    uint               getGeneration() const { return generation; }
+    // did the worker stop before finishing? (if so, there's nothing to keep)
+    bool               isCancelled() const { return cancelled; }
+    // the finished tile map, for putting into the preview cache
+    preview_t*         makePreview() const;
+
+signals:
+    void finished();
+
+private:
+    leveldata_t level;
+    QByteArray  key;
+    // which refresh this worker was started for, and the latest one
+    uint        generation;
+    const QAtomicInt *latest;
+    bool        cancelled;
+
+    const TileAtlas *tiles;
+    QImage      image;
+
+    // The maximum area of the playfield is 13312 tiles (or 26624 bytes.)
+    // Only the visible part of each row is actually stored.
+    // There are two layers with the same size and layout.
+    Playfield   playfield;
+};
+
 class PreviewWindow : public QDialog
 {
     Q_OBJECT
@@ -23,13 +76,35 @@ public:
     ~PreviewWindow();
 
     void setLevel(leveldata_t *level);
+    void setPalette(const palettes_t *palettes, int fg, int water);
+
+    // make tile maps for these levels in the background whenever nothing else is going on,
+    // so that switching to them later is instant (replaces any levels not done yet)
+    void prefetch(const QList<const leveldata_t*> &levels);
+    // how much memory the cached tile maps of recently seen levels can use
+    void setCacheSize(size_t bytes);
     
 public slots:
+    // make a new tile map for the level in the background, once it stops changing
     void refresh();
     void centerOn(int x, int y);
     void enableCenter(bool);
+    void enableNight(bool);
+    void enableAnimation(bool);
+    void showFrameTime(double ms);
     void savePreview();
 
+signals:
+    // the mouse moved onto (or clicked) a 2D map tile in the 3D display
+    void tileHovered(int x, int y);
+    void tileClicked(int x, int y);
+
+private slots:
+    void startWorker();
+    void workerFinished();
+    void startPrefetch();
+    void prefetchFinished();
+
 private:
     Ui::PreviewWindow *ui;
 
@@ -38,12 +113,30 @@ private:
     PreviewScene   *scene;
     bool           center;
 
-    // The maximum area of the playfield is 13312 tiles.
-    // The max for each dimension here was chosen as 384, but the
-    // length * width cannot ever exceed 13312 tiles (or 26624 bytes.)
-    // There are two playfields (one per layer) with the same size and layout.
-    uint16_t  playfield[2][MAX_FIELD_HEIGHT][MAX_FIELD_WIDTH];
+    // the current course palettes
+    const palettes_t *palettes;
+    int            fgPalette, waterPalette;
+    bool           night;
+
+    // timer for waiting until edits stop before starting the worker
+    QTimer         timer;
+    PreviewWorker  *worker;
+    // incremented on each refresh, so that results from older ones can be ignored
+    QAtomicInt     generation;
+    // was the level edited again while the worker was still running?
+    bool           pending;
+
+    // tile maps of recently seen (or prefetched) levels
+    PreviewCache   cache;
+    // levels waiting to be prefetched, and the timer for waiting until things are idle
+    QList<leveldata_t> prefetchLevels;
+    QTimer         prefetchTimer;
+    PreviewWorker  *prefetchWorker;
+    // the workers get their own threads, so closing the window only waits on them
+    // (and not on anything else running in the background)
+    QThreadPool    pool;
 
+    void showPreview(const preview_t *preview);
 };
 
 #endif // PREVIEWWINDOW_H
@@ -85,6 +85,8 @@ void PropertiesWindow::accept() {
     // apply level size
     level->header.length = ui->spinBox_Length->value();
     level->header.width  = ui->spinBox_Width ->value();
+    // (tiles may have been added to or removed from the level's area)
+    updateLevelStats(level);
 
     // apply FG/BG settings
     *bg    = ui->comboBox_Background->currentIndex();
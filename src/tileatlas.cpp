@@ -0,0 +1,114 @@
+/*
+  tileatlas.cpp
+
+  Contains the pre-flipped 3D tile atlas used to render the isometric view of levels.
+
+  This code is released under the terms of the MIT license.
+  See COPYING.txt for details.
+*/
+
+#include "tileatlas.h"
+#include "graphics.h"
+
+TileAtlas::TileAtlas()
+    : sheetHeight(0)
+{}
+
+bool TileAtlas::load(const QString &fileName) {
+    return load(QImage(fileName));
+}
+
+bool TileAtlas::load(const QImage &image) {
+    QImage sheet(image);
+    if (sheet.isNull()) {
+        atlas = QImage();
+        colors.clear();
+        bands.clear();
+        sheetHeight = 0;
+        return false;
+    }
+
+    // (the tile sheets should already be indexed, but just in case)
+    if (sheet.format() != QImage::Format_Indexed8)
+        sheet = sheet.convertToFormat(QImage::Format_Indexed8);
+
+    int width   = sheet.width()  & ~(ISO_TILE_SIZE - 1);
+    sheetHeight = sheet.height() & ~(ISO_TILE_SIZE - 1);
+
+    // renumber the sheet's colors so that color 0 is the only transparent one,
+    // and so that each band's colors are separate from the other bands'
+    QVector<QRgb> sheetColors = sheet.colorTable();
+    QVector<uint8_t> remap(numBands() * 256, 0);
+
+    colors.clear();
+    bands.clear();
+    colors.append(qRgba(0, 0, 0, 0));
+    bands.append(0);
+    for (int y = 0; y < sheetHeight; y++) {
+        int band = y / TILE_SHEET_BAND;
+        const uint8_t *src = sheet.constScanLine(y);
+
+        for (int x = 0; x < width; x++) {
+            uint8_t &color = remap[band * 256 + src[x]];
+            if (color || src[x] >= sheetColors.size() || qAlpha(sheetColors[src[x]]) < 0x80)
+                continue;
+
+            QRgb rgb = sheetColors[src[x]] | 0xFF000000;
+            if (colors.size() < TILE_ATLAS_COLORS) {
+                color = colors.size();
+                colors.append(rgb);
+                bands.append(band);
+            } else {
+                // out of room, so share a color with another band
+                color = qMax(colors.indexOf(rgb), 1);
+            }
+        }
+    }
+
+    atlas = QImage(width, 4 * sheetHeight, QImage::Format_Indexed8);
+    atlas.setColorTable(colors);
+
+    // copy each tile four times (once for each combination of flip bits)
+    for (int flip = 0; flip < 4; flip++) {
+        bool flipH = flip & 1;
+        bool flipV = flip & 2;
+
+        for (int y = 0; y < sheetHeight; y++) {
+            // row within the current tile
+            int row = y % ISO_TILE_SIZE;
+            int srcY = flipV ? y - row + (ISO_TILE_SIZE - 1 - row) : y;
+
+            const uint8_t *src = sheet.constScanLine(srcY);
+            const uint8_t *bandRemap = remap.constData() + (y / TILE_SHEET_BAND) * 256;
+            uint8_t *dest = atlas.scanLine(flip * sheetHeight + y);
+
+            for (int x = 0; x < width; x += ISO_TILE_SIZE) {
+                for (int col = 0; col < ISO_TILE_SIZE; col++) {
+                    dest[x + col] = bandRemap[src[x + (flipH ? ISO_TILE_SIZE - 1 - col : col)]];
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+QRect TileAtlas::tileRect(uint16_t tile) const {
+    // each palette zone is 216px tall and each row of tiles is 32 tiles long.
+    int x = (TILE(tile) % 32) * ISO_TILE_SIZE;
+    int y = (TILE(tile) / 32) * ISO_TILE_SIZE + (PALN(tile) * TILE_SHEET_BAND);
+
+    if (x + ISO_TILE_SIZE > atlas.width() || y + ISO_TILE_SIZE > sheetHeight)
+        return QRect();
+
+    int flip = (tile & FH ? 1 : 0) | (tile & FV ? 2 : 0);
+
+    return QRect(x, flip * sheetHeight + y, ISO_TILE_SIZE, ISO_TILE_SIZE);
+}
+
+const uint8_t* TileAtlas::tilePixels(uint16_t tile) const {
+    QRect rect = tileRect(tile);
+    if (rect.isEmpty()) return 0;
+
+    return atlas.constScanLine(rect.y()) + rect.x();
+}
@@ -0,0 +1,66 @@
+/*
+    This code is released under the terms of the MIT license.
+    See COPYING.txt for details.
+*/
+
+#ifndef TILEATLAS_H
+#define TILEATLAS_H
+
+#include <cstdint>
+#include <QImage>
+#include <QRect>
+#include <QString>
+#include <QVector>
+
+// height of each palette's section of the 3D tile sheet
+// (27 rows of 32 tiles each)
+#define TILE_SHEET_BAND 216
+// maximum number of colors in an atlas's color table
+// (the rest of the 256 are left for the preview's animated colors)
+#define TILE_ATLAS_COLORS 128
+
+/*
+  The 3D tile sheet, decoded once and stored with every flipped version of each tile,
+  so tiles can be copied straight from it without flipping them every time they're drawn.
+
+  The atlas holds four copies of the tile sheet stacked vertically: unflipped, flipped
+  horizontally, flipped vertically, and flipped both ways. Each 8x8 tile is flipped in
+  place, so a tile is at the same position in each copy.
+
+  The atlas is an 8-bit indexed image, so the same pixels can be shown with different
+  palettes just by changing the color table. Color 0 is always transparent and every
+  other color is opaque (like the real thing), which the preview renderer relies on.
+  Each palette band of the sheet gets its own color table entries (even for colors which
+  are the same in more than one band), so each band can be recolored separately.
+*/
+class TileAtlas {
+public:
+    TileAtlas();
+
+    // load a tile sheet and build the atlas from it
+    bool          load(const QString &fileName);
+    bool          load(const QImage &sheet);
+    bool          isNull() const { return atlas.isNull(); }
+
+    const QImage& image() const { return atlas; }
+    // the tile sheet's own colors
+    const QVector<QRgb>& colorTable() const { return colors; }
+    // which palette band each of those colors belongs to
+    const QVector<uint8_t>& colorBands() const { return bands; }
+    int           numBands() const { return (sheetHeight + TILE_SHEET_BAND - 1) / TILE_SHEET_BAND; }
+    // position of a tile (including palette and flip bits) in the atlas image,
+    // or an empty rect if the tile isn't in the tile sheet
+    QRect         tileRect(uint16_t tile) const;
+    // first pixel of a tile in the atlas image, or null if the tile isn't in the tile sheet
+    // (rows of the tile are stride() pixels apart)
+    const uint8_t* tilePixels(uint16_t tile) const;
+    int           stride() const { return atlas.bytesPerLine(); }
+
+private:
+    QImage        atlas;
+    QVector<QRgb> colors;
+    QVector<uint8_t> bands;
+    int           sheetHeight;
+};
+
+#endif // TILEATLAS_H
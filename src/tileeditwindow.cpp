@@ -200,52 +200,54 @@ void TileEditWindow::accept() {
     // after the tile edit window is done, apply the changes to the tiles
     for (int v = selY; v < selY + selLength; v++) {
         for (int h = selX; h < selX + selWidth; h++) {
-            maptile_t *newTile = &(level->tiles[v][h]);
+            maptile_t newTile = level->tiles[v][h];
 
-            if (newTile->geometry == 0 && tileInfo.geometry == -1) {
+            if (newTile.geometry == 0 && tileInfo.geometry == -1) {
                 continue;
             } else if (tileInfo.geometry == 0) {
-                *newTile = noTile;
+                setTile(level, h, v, noTile);
                 continue;
             }
 
             if (tileInfo.geometry >= 0)
-                newTile->geometry = tileInfo.geometry;
+                newTile.geometry = tileInfo.geometry;
             if (tileInfo.obstacle >= 0) {
                 // handle multiple types for water hazard based on terrain value
                 if (tileInfo.obstacle == water
-                        && newTile->geometry >= slopes && newTile->geometry < endSlopes)
-                    newTile->obstacle = water - 1 + newTile->geometry;
+                        && newTile.geometry >= slopes && newTile.geometry < endSlopes)
+                    newTile.obstacle = water - 1 + newTile.geometry;
                 // handle multiple types for bounce pads
                 else if (tileInfo.obstacle == bounceFlat
-                         && newTile->geometry >= slopes && newTile->geometry < slopesDouble)
-                    newTile->obstacle = bounce + newTile->geometry - slopes;
+                         && newTile.geometry >= slopes && newTile.geometry < slopesDouble)
+                    newTile.obstacle = bounce + newTile.geometry - slopes;
                 // handle multiple types for conveyor belts
                 else if (tileInfo.obstacle >= belts && tileInfo.obstacle < beltSlopes
-                         && newTile->geometry >= slopes && newTile->geometry < slopesDouble)
-                    newTile->obstacle = conveyorMap[tileInfo.obstacle - belts][newTile->geometry - slopes];
+                         && newTile.geometry >= slopes && newTile.geometry < slopesDouble)
+                    newTile.obstacle = conveyorMap[tileInfo.obstacle - belts][newTile.geometry - slopes];
                 else
-                    newTile->obstacle = tileInfo.obstacle;
+                    newTile.obstacle = tileInfo.obstacle;
             }
 
             if (tileInfo.bumperNorth >= 0)
-                newTile->flags.bumperNorth = tileInfo.bumperNorth;
+                newTile.flags.bumperNorth = tileInfo.bumperNorth;
             if (tileInfo.bumperSouth >= 0)
-                newTile->flags.bumperSouth = tileInfo.bumperSouth;
+                newTile.flags.bumperSouth = tileInfo.bumperSouth;
             if (tileInfo.bumperEast >= 0)
-                newTile->flags.bumperEast = tileInfo.bumperEast;
+                newTile.flags.bumperEast = tileInfo.bumperEast;
             if (tileInfo.bumperWest>= 0)
-                newTile->flags.bumperWest = tileInfo.bumperWest;
+                newTile.flags.bumperWest = tileInfo.bumperWest;
 
             if (relativeHeight)
-                newTile->height += newHeight;
+                newTile.height += newHeight;
             else
-                newTile->height = newHeight;
+                newTile.height = newHeight;
 
-            if      (layer2) newTile->flags.layer = 1;
-            else if (layer1) newTile->flags.layer = 0;
+            if      (layer2) newTile.flags.layer = 1;
+            else if (layer1) newTile.flags.layer = 0;
 
-            newTile->flags.dummy = 0;
+            newTile.flags.dummy = 0;
+
+            setTile(level, h, v, newTile);
         }
     }
 